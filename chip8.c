@@ -1,30 +1,94 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <time.h>
 
+#include "chip8.h"
+#include "tools.h"
 
 
-#define MEMORY_SIZE 4096
-#define MAX_ROM_SIZE (4096 - 200)
+#define MEMORY_SIZE CHIP8_MEMORY_SIZE
+#define MEM_MASK (MEMORY_SIZE - 1)
+#define MAX_ROM_SIZE (MEMORY_SIZE - 0x200)
+#define XO_MEMORY_SIZE 65536    // XO-CHIP's, every other machine has MEMORY_SIZE
+#define XO_MASK (XO_MEMORY_SIZE - 1)
+#define XO_MAX_ROM_SIZE (XO_MEMORY_SIZE - 0x200)
 #define NUM_REGS 16
 #define MAX_SUBROUTINES 16
-#define WIDTH 64
-#define HEIGHT 32
+#define PAGE_BITS 8             // guest memory is shared copy-on-write in pages of 256 bytes
+#define MEM_PAGE_SIZE (1 << PAGE_BITS)
+#define MEM_PAGES (MEMORY_SIZE / MEM_PAGE_SIZE)
+#define MAX_PAGES (XO_MEMORY_SIZE / MEM_PAGE_SIZE)
+#define WIDTH CHIP8_WIDTH
+#define HEIGHT CHIP8_HEIGHT
+#define HI_WIDTH CHIP8_HIRES_WIDTH
+#define HI_HEIGHT CHIP8_HIRES_HEIGHT
+#define SCREEN_WORDS (HI_WIDTH / 64 * HI_HEIGHT)    // lores uses the first HEIGHT, one per row
+#define PLANES 2
+#define BIG_FONT 0x50           // SUPER-CHIP's 8x10 digits, right after the small ones
+#define TIMER_HZ CHIP8_TIMER_HZ
+#define DEFAULT_IPS CHIP8_DEFAULT_IPS
 
 
-typedef struct Chip8{
+// one predecoded instruction, see decode()
+typedef struct Instr{
+    uint8_t         op;         // OP_* handler
+    uint8_t         x, y, n;
+    uint16_t        nnn;        // kk is the low byte
+} Instr;
+
+// what only SUPER-CHIP and XO-CHIP machines need, allocated when a chip becomes one (load_rom_as())
+struct Ext{
+    uint64_t        screen[PLANES][SCREEN_WORDS]; // one or two words per row, lores uses the first HEIGHT
+    uint8_t         *mem[MAX_PAGES];      // XO-CHIP's 64 KB by page, like Chip8's mem[]
+    Instr           *code[MAX_PAGES];
+    uint64_t        own_mem[MAX_PAGES / 64], own_code[MAX_PAGES / 64];
+};
+
+struct Chip8{
     // unsigned short  pc, I, opcode, sp;
     uint16_t        pc, I, opcode, sp;
     unsigned short  stack[MAX_SUBROUTINES];
     uint8_t         v[NUM_REGS];
     unsigned char   delayTimer, soundTimer;
-    unsigned char   memory[MEMORY_SIZE];
-    int             screen[HEIGHT][WIDTH];
+    uint64_t        cycles;    // instructions run so far, this is the emulated clock
+    uint64_t        next_tick; // value of cycles at which the timers count down next
+    uint32_t        ipf;       // instructions per timer tick (per 60 Hz frame)
+    uint64_t        rng;       // xorshift64* state for Cxkk, see chip8_seed()
+    uint16_t        keys;      // bit k is set while key k is down
+    uint64_t        next_input; // value of cycles at which the next replayed key event is due
+    Chip8Input      *input;    // replay being fed in / session being recorded, or NULL
+    uint8_t         *mem[MEM_PAGES];      // guest memory by page: the rom image's, or our own copy
+    Instr           *code[MEM_PAGES];     // decoded op starting at each address, paged the same way
+    uint64_t        own_mem[1], own_code[1]; // bit p: page p is our own copy, see mem_own()
+    uint16_t        mask;     // addresses wrap at mask + 1, the size of the variant's memory
+    uint16_t        pages;    // of mem and code in use
+    uint8_t         variant;  // CHIP8_VARIANT_*, which core chip8_run() uses
+    uint8_t         variant_set;          // chip8_set_variant() chose, chip8_load_file() won't
+    uint8_t         hires;    // SUPER-CHIP/XO-CHIP 128x64 mode
+    uint8_t         planes;   // XO-CHIP bit planes drawn to, 1 everywhere else
+    uint8_t         flags[NUM_REGS];      // SUPER-CHIP Fx75/Fx85 storage
+    struct RomImage *image;   // the rom (and fonts) the shared pages belong to
+    uint64_t        screen[HEIGHT];       // one bit per pixel, x = 0 is the top bit of the row
+    struct Ext      *ext;     // hires screens and XO-CHIP's page tables, NULL on CHIP-8
+    uint8_t         screen_dirty;         // screen changed since the renderer last looked
     size_t          rom_size;
-    char            hrop[50]; // human readable opcode
-} Chip8;
+    struct Trace    *trace;   // ring of recently run instructions, NULL if not tracing
+    uint8_t         fuse;     // bit i: idioms[i] runs as a superinstruction, see fuse_at()
+    struct Grams    *grams;   // the op pairs and triples the idioms were picked from, or NULL
+    struct Debug    *debug;   // breakpoints and watchpoints, see debug_mark(). NULL if not debugging
+#ifdef CHIP8_PROFILE
+    struct Profile  *prof;    // what run_core() ran, see prof_op()
+#endif
+    struct Jit      *jit;     // compiled code cache, NULL unless running through chip8_run_jit()
+    const uint8_t   *code_map; // nonzero for bytes that compiled code (jit or aot) was built from
+    void            (*code_write)(struct Chip8 *chip, uint16_t addr); // one of those bytes changed
+    void            *code_ctx; // for whoever set code_write
+    uint8_t         owned;    // chip8_create() allocated it, chip8_destroy() frees it
+};
 
 static const uint8_t fonts[] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -45,64 +109,127 @@ static const uint8_t fonts[] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-void loadfonts(Chip8 *chip) {
+// SUPER-CHIP's 8x10 digits, at BIG_FONT. XO-CHIP has A-F as well, SUPER-CHIP roms never ask
+static const uint8_t big_fonts[] = {
+    0x3C, 0x7E, 0xE7, 0xC3, 0xC3, 0xC3, 0xC3, 0xE7, 0x7E, 0x3C, // 0
+    0x18, 0x38, 0x58, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x3C, // 1
+    0x3E, 0x7F, 0xC3, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xFF, 0xFF, // 2
+    0x3C, 0x7E, 0xC3, 0x03, 0x0E, 0x0E, 0x03, 0xC3, 0x7E, 0x3C, // 3
+    0x06, 0x0E, 0x1E, 0x36, 0x66, 0xC6, 0xFF, 0xFF, 0x06, 0x06, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFC, 0xFE, 0x03, 0xC3, 0x7E, 0x3C, // 5
+    0x3E, 0x7C, 0xE0, 0xC0, 0xFC, 0xFE, 0xC3, 0xC3, 0x7E, 0x3C, // 6
+    0xFF, 0xFF, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x60, 0x60, // 7
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7E, 0x7E, 0xC3, 0xC3, 0x7E, 0x3C, // 8
+    0x3C, 0x7E, 0xC3, 0xC3, 0x7F, 0x3F, 0x03, 0x03, 0x3E, 0x7C, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+void loadfonts(uint8_t *memory) {
     size_t n = sizeof(fonts)/sizeof(*fonts);
     size_t i;
     for (i = 0; i < n; i++){
-        chip->memory[i] = fonts[i];
+        memory[i] = fonts[i];
     }
 }
 
+/*
+    guest addresses wrap at the size of the machine's memory. the cores pass that as a constant
+    mask to the _m accessors; everything else goes through the plain ones and chip->mask.
+*/
+#define PAGE_M(addr, mask)  (((addr) & (mask)) >> PAGE_BITS)
+#define PAGE(addr)   PAGE_M(addr, MEM_MASK)
+#define OFFSET(addr) ((addr) & (MEM_PAGE_SIZE - 1))
+#define OWNS(bits, p) ((bits)[(p) >> 6] >> ((p) & 63) & 1)
+
+// 4 KB machines keep their page tables in the Chip8, XO-CHIP's 256 pages are in chip->ext
+#define MEM_TAB(chip, mask)     ((mask) > MEM_MASK ? (chip)->ext->mem : (chip)->mem)
+#define CODE_TAB(chip, mask)    ((mask) > MEM_MASK ? (chip)->ext->code : (chip)->code)
+#define OWN_MEM(chip, mask)     ((mask) > MEM_MASK ? (chip)->ext->own_mem : (chip)->own_mem)
+#define OWN_CODE(chip, mask)    ((mask) > MEM_MASK ? (chip)->ext->own_code : (chip)->own_code)
+_Static_assert(MEM_PAGES <= 64, "a 4 KB machine's own pages are one word of bits");
+
+static inline uint8_t mem_read_m(const Chip8 *chip, uint16_t addr, uint16_t mask){
+    return MEM_TAB(chip, mask)[PAGE_M(addr, mask)][OFFSET(addr)];
+}
+
+static inline Instr *code_at_m(const Chip8 *chip, uint16_t addr, uint16_t mask){
+    return &CODE_TAB(chip, mask)[PAGE_M(addr, mask)][OFFSET(addr)];
+}
+
+static inline uint8_t mem_read(const Chip8 *chip, uint16_t addr){
+    return mem_read_m(chip, addr, chip->mask);
+}
+
+static inline Instr *code_at(const Chip8 *chip, uint16_t addr){
+    return code_at_m(chip, addr, chip->mask);
+}
+
 void getop(Chip8 *chip){
-    chip->opcode = chip->memory[chip->pc] << 8 | chip->memory[chip->pc+1];
+    chip->opcode = mem_read(chip, chip->pc) << 8 | mem_read(chip, chip->pc + 1);
     // printf("Generated opcode: %x", )
 }
 
+#define PIXEL(x) (1ULL << (WIDTH - 1 - (x)))
+
+int getpix(Chip8 *chip, int x, int y){
+    return (chip->screen[y] & PIXEL(x)) != 0;
+}
+
 int flippix(Chip8 *chip, int x, int y){
     if (y < 0 || y >= HEIGHT) return 0;
     if (x < 0 || x >= WIDTH) return 0;
-    chip->screen[y][x] ^= 1;
-    return !chip->screen[y][x];
-}
-
-void init_mem(Chip8 *chip){
-    for(int i = 0; i < MEMORY_SIZE; i++){
-        chip->memory[i] = 0x0;
-    }
+    chip->screen[y] ^= PIXEL(x);
+    return !getpix(chip, x, y);
 }
 
 void print_rom_in_memory(Chip8 *chip){
     printf("Rom in memory. size: %zu bytes\n", chip->rom_size);
     for(int i = chip->pc-8; i < chip->pc+12; i+=2){
         printf("%s", chip->pc == i ? "------>\t" : "\t");
-        printf("memory[%x]: %02x%02x\n", i, chip->memory[i],chip->memory[i+1]);
+        printf("memory[%x]: %02x%02x\n", i, mem_read(chip, i), mem_read(chip, i+1));
     }
 }
 
 void print_rom_memory(Chip8 *chip){
     printf("Chip8 memory space: \n");
     for(int i = 0x200; i <= (0x200 + chip->rom_size); i++){
-        printf("\tmemory[%d]: %x\n", i, chip->memory[i]);
+        printf("\tmemory[%d]: %x\n", i, mem_read(chip, i));
     }
 }
 
 void print_emulator_memory_space(Chip8 *chip){
     printf("Chip8 emulator memory space: \n");
     for(int i = 0x0; i <= 0x200 ; i++){
-        printf("\tmemory[%d]: %x\n", i, chip->memory[i]);
+        printf("\tmemory[%d]: %x\n", i, mem_read(chip, i));
     }
 }
 
 void clear_screen(Chip8 *chip){
     memset(chip->screen, 0, sizeof(chip->screen));
+    if (chip->ext != NULL)
+        memset(chip->ext->screen, 0, sizeof(chip->ext->screen));
+}
+
+static const uint64_t no_plane[SCREEN_WORDS];  // what a machine shows for a plane it doesn't have
+
+// plane p of the screen: HEIGHT rows of one word on CHIP-8, SCREEN_WORDS everywhere else
+static inline const uint64_t *screen_plane(const Chip8 *chip, int p){
+    if (chip->ext != NULL)
+        return chip->ext->screen[p & 1];
+    return p & 1 ? no_plane : chip->screen;
 }
 
 void print_screen_debug(Chip8 *chip){
     printf("Screen: \n");
     for(int i = 0; i < HEIGHT; i++){
         for(int j = 0; j < WIDTH; j++){
-            if(chip->screen[i][j] !=0)
-                printf("%s", chip->screen[i][j] ? "*" : "");
+            if(getpix(chip, j, i))
+                printf("%s", "*");
             else
                 printf(" ");
         }
@@ -134,473 +261,4689 @@ void print_stack(Chip8 *chip){
     
 }
 
-void interpreter(Chip8 *chip){
-    getop(chip);
-    uint16_t opcode = chip->opcode;
-    printf("interpreting: 0x%04x\n", opcode);
-    uint8_t x = (opcode & 0x0F00)>> 8; // in AxyB get x
-    uint8_t y = (opcode & 0x00F0) >> 4; // in AxyB get y
+/*
+    every opcode is decoded once into an Instr and cached per address in chip->code, so the
+    hot loop never has to re-extract x/y/kk/nnn or walk the nested opcode switch again.
+    a rom image comes with every address decoded (see rom_image_build()); memory writes reset
+    the entries they overlap to OP_DECODE, and those get filled in again when reached.
+*/
+#define OPS(X) \
+    X(OP_DECODE)   /* not decoded yet */ \
+    X(OP_BAD)      /* unknown / unimplemented opcode, pc stays put */ \
+    X(OP_CLS)      /* 00E0 */ \
+    X(OP_RET)      /* 00EE */ \
+    X(OP_JP)       /* 1nnn */ \
+    X(OP_CALL)     /* 2nnn */ \
+    X(OP_SE_KK)    /* 3xkk */ \
+    X(OP_SNE_KK)   /* 4xkk */ \
+    X(OP_SE_XY)    /* 5xy0 */ \
+    X(OP_LD_KK)    /* 6xkk */ \
+    X(OP_ADD_KK)   /* 7xkk */ \
+    X(OP_LD_XY)    /* 8xy0 */ \
+    X(OP_OR)       /* 8xy1 */ \
+    X(OP_AND)      /* 8xy2 */ \
+    X(OP_XOR)      /* 8xy3 */ \
+    X(OP_ADD_XY)   /* 8xy4 */ \
+    X(OP_SUB)      /* 8xy5 */ \
+    X(OP_SHR)      /* 8xy6 */ \
+    X(OP_SUBN)     /* 8xy7 */ \
+    X(OP_SHL)      /* 8xyE */ \
+    X(OP_SNE_XY)   /* 9xy0 */ \
+    X(OP_LD_I)     /* Annn */ \
+    X(OP_JP_V0)    /* Bnnn */ \
+    X(OP_RND)      /* Cxkk */ \
+    X(OP_DRW)      /* Dxyn */ \
+    X(OP_SKP)      /* Ex9E */ \
+    X(OP_SKNP)     /* ExA1 */ \
+    X(OP_WAIT_DT)  /* Fx07 at the head of a delay timer wait loop, see decode_at() */ \
+    X(OP_LD_VDT)   /* Fx07 */ \
+    X(OP_LD_K)     /* Fx0A */ \
+    X(OP_LD_DT)    /* Fx15 */ \
+    X(OP_LD_ST)    /* Fx18 */ \
+    X(OP_ADD_I)    /* Fx1E */ \
+    X(OP_LD_F)     /* Fx29 */ \
+    X(OP_LD_B)     /* Fx33 */ \
+    X(OP_LD_MEM)   /* Fx55 */ \
+    X(OP_LD_REG)   /* Fx65 */ \
+    /* SUPER-CHIP, decode() leaves these OP_BAD, decode_for() makes them */ \
+    X(OP_SCD)      /* 00Cn scroll down n rows */ \
+    X(OP_SCR)      /* 00FB scroll right 4 */ \
+    X(OP_SCL)      /* 00FC scroll left 4 */ \
+    X(OP_EXIT)     /* 00FD */ \
+    X(OP_LOW)      /* 00FE */ \
+    X(OP_HIGH)     /* 00FF */ \
+    X(OP_LD_HF)    /* Fx30 */ \
+    X(OP_LD_R)     /* Fx75 */ \
+    X(OP_LD_RV)    /* Fx85 */ \
+    /* XO-CHIP only */ \
+    X(OP_SCU)      /* 00Dn scroll up n rows */ \
+    X(OP_SAVE_RANGE) /* 5xy2 */ \
+    X(OP_LOAD_RANGE) /* 5xy3 */ \
+    X(OP_LD_I_LONG)  /* F000 nnnn, nnn holds the whole second word */ \
+    X(OP_PLANE)    /* Fn01 */ \
+    X(OP_AUDIO)    /* F002 */ \
+    X(OP_PITCH)    /* Fx3A */ \
+    /* superinstructions, only fuse_at() makes them. see idioms[] */ \
+    X(OP_FUSE_SPRITE) /* 6xkk 6ykk Annn Dxyn */ \
+    X(OP_FUSE_LOOP)   /* 7xkk 3xkk/4xkk 1nnn */ \
+    X(OP_FUSE_WAIT)   /* a whole OP_WAIT_DT loop */ \
+    X(OP_FUSE_LD2)    /* 6xkk 6ykk */ \
+    X(OP_FUSE_DRAW)   /* Annn Dxyn */ \
+    /* the debugger's, only debug_mark() makes it */ \
+    X(OP_BREAK)    /* stands for the op in Debug.orig[] */
+
+#define OP_ENUM(op) op,
+enum { OPS(OP_ENUM) OP_COUNT };
+
+#define OP_NAME(op) #op,
+static const char *op_names[OP_COUNT] = { OPS(OP_NAME) };
+
+/*
+    superinstructions. a lot of what roms run is a handful of idioms: set up x, y and I then
+    draw, count a register up to a limit, spin on the delay timer. a chip that has fusion on
+    (see chip8_fuse()) gets the first instruction of every such sequence turned into one op
+    that runs the whole idiom, so it goes through dispatch once instead of three or four
+    times. the rest of the sequence stays decoded as it was and the fused op reads it from
+    there, which is why an idiom never crosses a page of decoded ops.
+    which idioms a chip fuses comes from how often their op pairs and triples ran, counted
+    over a warmup or loaded from a saved profile (see fuse_pick()).
+*/
+#define FUSE_MAX    4                   // instructions in the longest idiom
+
+typedef struct Idiom {
+    const char      *name;
+    uint8_t         fused;              // the OP_FUSE_* its first instruction becomes
+    uint8_t         len;
+    uint8_t         ops[FUSE_MAX];      // what the instructions have to be decoded as
+} Idiom;
+
+// longest first, fuse_at() takes the first one that fits
+static const Idiom idioms[] = {
+    { "sprite",     OP_FUSE_SPRITE, 4, { OP_LD_KK, OP_LD_KK, OP_LD_I, OP_DRW } },
+    { "count up",   OP_FUSE_LOOP,   3, { OP_ADD_KK, OP_SE_KK, OP_JP } },
+    { "count down", OP_FUSE_LOOP,   3, { OP_ADD_KK, OP_SNE_KK, OP_JP } },
+    { "wait until", OP_FUSE_WAIT,   3, { OP_WAIT_DT, OP_SE_KK, OP_JP } },
+    { "wait while", OP_FUSE_WAIT,   3, { OP_WAIT_DT, OP_SNE_KK, OP_JP } },
+    { "load pair",  OP_FUSE_LD2,    2, { OP_LD_KK, OP_LD_KK } },
+    { "draw at",    OP_FUSE_DRAW,   2, { OP_LD_I, OP_DRW } },
+};
+#define IDIOMS ((int)(sizeof(idioms) / sizeof(idioms[0])))
+
+// what the first instruction of a superinstruction was decoded as, anything else is itself
+static inline uint8_t op_base(uint8_t op){
+    static const uint8_t base[OP_COUNT] = {
+        [OP_FUSE_SPRITE] = OP_LD_KK, [OP_FUSE_LOOP] = OP_ADD_KK, [OP_FUSE_WAIT] = OP_WAIT_DT,
+        [OP_FUSE_LD2] = OP_LD_KK, [OP_FUSE_DRAW] = OP_LD_I,
+    };
+    return base[op] ? base[op] : op;
+}
+
+// bytes of memory a decoded op was made from when that's more than its own two, see mem_write_m()
+static const uint8_t op_span[OP_COUNT] = {
+    [OP_WAIT_DT] = 6, [OP_LD_I_LONG] = 4, [OP_BREAK] = 6,
+    [OP_FUSE_SPRITE] = 8, [OP_FUSE_LOOP] = 6, [OP_FUSE_WAIT] = 6, [OP_FUSE_LD2] = 4, [OP_FUSE_DRAW] = 4,
+};
+
+/*
+    execution trace. when a ring is attached, every instruction run by chip8_run() leaves one
+    8 byte record behind; nothing is formatted until the ring is dumped (see chip8_trace_dump()).
+    the fuzzer hangs its coverage and fault checks on the same hook (see fuzz_record()).
+    build with -DCHIP8_NO_TRACE to take the hook out of the hot loop altogether.
+*/
+#define TRACE_SIZE  4096               // records kept, power of two
+#define TRACE_NO_REG 0xFF
+
+typedef struct TraceRec {
+    uint16_t        pc, opcode, I;     // opcode as read from memory after it ran
+    uint8_t         reg;               // V register it wrote (0-F), or TRACE_NO_REG
+    uint8_t         val;               // the value it wrote
+} TraceRec;
+
+typedef struct Trace {
+    uint64_t        count;             // records ever written, the ring holds the last TRACE_SIZE
+    struct Fuzz     *fuzz;             // fuzzing instead of recording, the ring isn't used
+    struct Grams    *grams;            // or counting ops for fusion, see gram_record()
+    TraceRec        rec[TRACE_SIZE];
+} Trace;
+
+static void fuzz_record(Chip8 *chip, uint16_t pc, const Instr *in);
+static void gram_record(Chip8 *chip, uint16_t pc, const Instr *in);
+
+// which V register each handler writes: x, VF, V0 through Vx for Fx65, Vx through Vy for 5xy3, or none
+enum { W_NONE, W_X, W_F, W_LAST, W_Y };
+static const uint8_t op_writes[OP_COUNT] = {
+    [OP_LD_KK] = W_X, [OP_ADD_KK] = W_X, [OP_LD_XY] = W_X, [OP_OR] = W_X, [OP_AND] = W_X,
+    [OP_XOR] = W_X, [OP_ADD_XY] = W_X, [OP_SUB] = W_X, [OP_SHR] = W_X, [OP_SUBN] = W_X,
+    [OP_SHL] = W_X, [OP_RND] = W_X, [OP_WAIT_DT] = W_X, [OP_LD_VDT] = W_X, [OP_LD_K] = W_X, [OP_LD_REG] = W_LAST,
+    [OP_DRW] = W_F, [OP_LD_RV] = W_LAST, [OP_LOAD_RANGE] = W_Y,
+    [OP_FUSE_SPRITE] = W_X, [OP_FUSE_LOOP] = W_X, [OP_FUSE_WAIT] = W_X, [OP_FUSE_LD2] = W_X,
+};
+
+// the fuzzer and fusion's warmup use the ring's hook for their own ends
+static void trace_hook(Chip8 *chip, uint16_t pc, const Instr *in){
+    if (chip->trace->fuzz != NULL)
+        fuzz_record(chip, pc, in);
+    else
+        gram_record(chip, pc, in);
+}
+
+static inline void trace_record(Chip8 *chip, uint16_t pc, const Instr *in){
+    if (chip->trace->fuzz != NULL || chip->trace->grams != NULL){
+        trace_hook(chip, pc, in);
+        return;
+    }
+    TraceRec *r = &chip->trace->rec[chip->trace->count++ & (TRACE_SIZE - 1)];
+    r->pc = pc;
+    r->opcode = mem_read(chip, pc) << 8 | mem_read(chip, pc + 1);
+    r->I = chip->I;
+    switch (op_writes[in->op]){
+        case W_X: case W_LAST: r->reg = in->x; break;
+        case W_Y:  r->reg = in->y; break;
+        case W_F:  r->reg = 0xF; break;
+        default:   r->reg = TRACE_NO_REG; break;
+    }
+    r->val = r->reg == TRACE_NO_REG ? 0 : chip->v[r->reg];
+}
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+    profiling build (make profile, or -DCHIP8_PROFILE). run_core() counts every instruction it
+    runs by handler and by address, clocks each handler on the host, and keeps histograms of
+    how deep calls go and how many rows each Dxyn draws. every chip counts on its own; the
+    sum over all of them, live or destroyed, is written to $CHIP8_PROFILE_OUT (default
+    chip8-profile.json, csv if the name ends in .csv) at exit and whenever SIGUSR1 comes in.
+    the recompilers and the wide lanes don't go through run_core(), and what idle_skip() jumps
+    over only shows up in the skipped total.
+    without CHIP8_PROFILE the hooks are empty macros and none of this is compiled.
+*/
+#ifdef CHIP8_PROFILE
+#include <signal.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define PROF_DEPTHS (MAX_SUBROUTINES + 2)   // call depth 1-16, and past the stack
+#define PROF_ROWS   17                      // rows a Dxyn drew after clipping, 0-16
+
+typedef struct Profile {
+    uint64_t        count[OP_COUNT];        // instructions run, by handler
+    uint64_t        ticks[OP_COUNT];        // host clock they took, see prof_ticks()
+    uint64_t        pc[MEMORY_SIZE];        // instructions run, by address
+    uint64_t        depth[PROF_DEPTHS];     // calls, by the depth they went to
+    uint64_t        rows[PROF_ROWS];        // Dxyn, by rows drawn
+    uint64_t        collisions;             // Dxyn that erased something
+    uint64_t        skipped;                // instructions idle_skip() didn't have to run
+    uint64_t        t;                      // clock when the last instruction finished
+    struct Profile  *next, **link;          // on prof_live
+} Profile;
+
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static Profile *prof_live;                  // every chip that has run
+static Profile prof_gone;                   // the sum of the destroyed ones
+static uint64_t prof_t0, prof_ns0;          // to turn ticks into ns
+static volatile sig_atomic_t prof_wanted;   // SIGUSR1 came in, the next run_core() dumps
+
+// the time stamp counter where there is one, it costs a fraction of a clock_gettime()
+static inline uint64_t prof_ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+static void prof_add(Profile *sum, const Profile *p){
+    for (int i = 0; i < OP_COUNT; i++){
+        sum->count[i] += p->count[i];
+        sum->ticks[i] += p->ticks[i];
+    }
+    for (int i = 0; i < MEMORY_SIZE; i++)
+        sum->pc[i] += p->pc[i];
+    for (int i = 0; i < PROF_DEPTHS; i++)
+        sum->depth[i] += p->depth[i];
+    for (int i = 0; i < PROF_ROWS; i++)
+        sum->rows[i] += p->rows[i];
+    sum->collisions += p->collisions;
+    sum->skipped += p->skipped;
+}
+
+static void prof_write(FILE *out, const Profile *p, double ns_per_tick, int csv){
+    uint64_t total = 0, ticks = 0;
+    for (int i = 0; i < OP_COUNT; i++){
+        total += p->count[i];
+        ticks += p->ticks[i];
+    }
+    if (csv){
+        fprintf(out, "section,key,count,ns\n");
+        fprintf(out, "total,instructions,%llu,%.0f\n", (unsigned long long)total, ticks * ns_per_tick);
+        fprintf(out, "total,skipped,%llu,\n", (unsigned long long)p->skipped);
+        for (int i = 0; i < OP_COUNT; i++)
+            if (p->count[i] != 0)
+                fprintf(out, "op,%s,%llu,%.0f\n", op_names[i] + 3,
+                        (unsigned long long)p->count[i], p->ticks[i] * ns_per_tick);
+        for (int i = 0; i < MEMORY_SIZE; i++)
+            if (p->pc[i] != 0)
+                fprintf(out, "pc,0x%03x,%llu,\n", i, (unsigned long long)p->pc[i]);
+        for (int i = 1; i < PROF_DEPTHS; i++)
+            fprintf(out, "call_depth,%d,%llu,\n", i, (unsigned long long)p->depth[i]);
+        for (int i = 0; i < PROF_ROWS; i++)
+            fprintf(out, "draw_rows,%d,%llu,\n", i, (unsigned long long)p->rows[i]);
+        fprintf(out, "draw_collisions,,%llu,\n", (unsigned long long)p->collisions);
+        return;
+    }
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"skipped\": %llu,\n  \"ns\": %.0f,\n  \"ops\": [",
+            (unsigned long long)total, (unsigned long long)p->skipped, ticks * ns_per_tick);
+    const char *sep = "\n";
+    for (int i = 0; i < OP_COUNT; i++){
+        if (p->count[i] == 0)
+            continue;
+        fprintf(out, "%s    {\"op\": \"%s\", \"count\": %llu, \"ns\": %.0f}", sep, op_names[i] + 3,
+                (unsigned long long)p->count[i], p->ticks[i] * ns_per_tick);
+        sep = ",\n";
+    }
+    // the heatmap is the whole of memory, index = address
+    fprintf(out, "\n  ],\n  \"pc\": [");
+    for (int i = 0; i < MEMORY_SIZE; i++)
+        fprintf(out, "%s%llu", i == 0 ? "" : i % 16 ? "," : ",\n    ", (unsigned long long)p->pc[i]);
+    // call_depth[0] is depth 1, the last one is calls past the top of the stack
+    fprintf(out, "],\n  \"call_depth\": [");
+    for (int i = 1; i < PROF_DEPTHS; i++)
+        fprintf(out, "%s%llu", i == 1 ? "" : ", ", (unsigned long long)p->depth[i]);
+    fprintf(out, "],\n  \"draw_rows\": [");
+    for (int i = 0; i < PROF_ROWS; i++)
+        fprintf(out, "%s%llu", i == 0 ? "" : ", ", (unsigned long long)p->rows[i]);
+    fprintf(out, "],\n  \"draw_collisions\": %llu\n}\n", (unsigned long long)p->collisions);
+}
+
+// live chips are read while they may still be running: the numbers are a snapshot, not exact
+static void prof_dump(void){
+    Profile *sum = (Profile*)malloc(sizeof(Profile));
+    if (sum == NULL)
+        return;
+    pthread_mutex_lock(&prof_lock);
+    *sum = prof_gone;
+    for (Profile *p = prof_live; p != NULL; p = p->next)
+        prof_add(sum, p);
+    pthread_mutex_unlock(&prof_lock);
+
+    uint64_t ticks = prof_ticks() - prof_t0, ns = now_ns() - prof_ns0;
+    const char *path = getenv("CHIP8_PROFILE_OUT");
+    if (path == NULL || *path == 0)
+        path = "chip8-profile.json";
+    size_t len = strlen(path);
+    FILE *out = fopen(path, "w");
+    if (out == NULL){
+        fprintf(stderr, "Error: opening profile %s\n", path);
+    } else {
+        prof_write(out, sum, ticks != 0 ? (double)ns / ticks : 1, len >= 4 && strcmp(path + len - 4, ".csv") == 0);
+        fclose(out);
+    }
+    free(sum);
+}
+
+static void prof_signal(int sig){
+    (void)sig;
+    prof_wanted = 1;
+}
+
+static void prof_open(Chip8 *chip){
+    Profile *p = (Profile*)calloc(1, sizeof(Profile));
+    if (p == NULL){
+        fprintf(stderr, "%s", "Error: allocating profile\n");
+        exit(1);
+    }
+    pthread_mutex_lock(&prof_lock);
+    if (prof_t0 == 0){
+        prof_t0 = prof_ticks();
+        prof_ns0 = now_ns();
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = prof_signal;
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGUSR1, &sa, NULL);
+        atexit(prof_dump);
+    }
+    p->next = prof_live;
+    p->link = &prof_live;
+    if (prof_live != NULL)
+        prof_live->link = &p->next;
+    prof_live = p;
+    pthread_mutex_unlock(&prof_lock);
+    chip->prof = p;
+}
+
+// the chip is going away, its counts go on into the totals
+static void prof_close(Chip8 *chip){
+    Profile *p = chip->prof;
+    if (p == NULL)
+        return;
+    pthread_mutex_lock(&prof_lock);
+    prof_add(&prof_gone, p);
+    *p->link = p->next;
+    if (p->next != NULL)
+        p->next->link = p->link;
+    pthread_mutex_unlock(&prof_lock);
+    free(p);
+    chip->prof = NULL;
+}
+
+static inline void prof_begin(Chip8 *chip){
+    if (chip->prof == NULL)
+        prof_open(chip);
+    if (prof_wanted){
+        prof_wanted = 0;
+        prof_dump();
+    }
+    chip->prof->t = prof_ticks();
+}
+
+// after each instruction: it gets the time since the one before
+static inline void prof_op(Chip8 *chip, uint16_t at, const Instr *in){
+    Profile *p = chip->prof;
+    uint64_t t = prof_ticks();
+    p->count[in->op]++;
+    p->ticks[in->op] += t - p->t;
+    p->t = t;
+    p->pc[at & MEM_MASK]++;
+    if (in->op == OP_CALL)
+        p->depth[chip->sp < PROF_DEPTHS - 1 ? chip->sp : PROF_DEPTHS - 1]++;
+}
+
+static inline void prof_draw(Chip8 *chip, int rows, int hit){
+    chip->prof->rows[rows]++;
+    chip->prof->collisions += hit;
+}
+
+static inline void prof_skip(Chip8 *chip, uint64_t n){
+    if (chip->prof != NULL)
+        chip->prof->skipped += n;
+}
+#else
+#define prof_begin(chip)            do { } while(0)
+#define prof_op(chip, at, in)       do { } while(0)
+#define prof_draw(chip, rows, hit)  do { } while(0)
+#define prof_skip(chip, n)          do { } while(0)
+#define prof_close(chip)            do { } while(0)
+#endif
+
+Instr decode(uint16_t opcode){
+    Instr in;
+    in.x   = (opcode & 0x0F00) >> 8; // in AxyB get x
+    in.y   = (opcode & 0x00F0) >> 4; // in AxyB get y
+    in.n   = opcode & 0x000F;
+    in.nnn = opcode & 0x0FFF;        // kk is the low byte of nnn
+    in.op  = OP_BAD;
 
     switch (opcode & 0xF000){
         case 0x0000:
-            /* fall in if opcode is an instruction starting with 0x0___*/
-            switch(opcode){
-                case 0x00E0:{ // CLR (clear screen)
-                    strcpy(chip->hrop, "CLR\0");
-                    clear_screen(chip);
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x00EE: {// RET return from subroutine
-                    strcpy(chip->hrop, "RET. return from subroutine\0");
-                    chip->pc = chip->stack[chip->sp--];
-                    chip->pc +=2;
-                    break;
-                }
-            }
-            break;
-        case 0x1000:{ // 1nnn: JP to addr nnn
-            strcpy(chip->hrop, "JP to Addr nnn\0");
-            chip->pc = (opcode & 0x0FFF);
-            break;
-        }
-        case 0x2000:{ // 2nnn:  CALL subroutine at addr nnn
-            strcpy(chip->hrop, "CALL subroutine at nnn\0");
-            chip->stack[++chip->sp] = chip->pc;
-            chip->pc = (opcode & 0x0FFF);
+            if (opcode == 0x00E0) in.op = OP_CLS;
+            else if (opcode == 0x00EE) in.op = OP_RET;
             break;
-        }
-        case 0x3000:{ // 3xkk: SE Vx, byte. if v[x] == kk (immediate byte) skip next instruction (pc + 2)
-            strcpy(chip->hrop, "3xkk Skip if Vx == kk\0");
-            if (chip->v[x] == (opcode & 0x00FF)){
-                chip->pc += 4;
-            }else {
-                chip->pc += 2;
+        case 0x1000: in.op = OP_JP; break;
+        case 0x2000: in.op = OP_CALL; break;
+        case 0x3000: in.op = OP_SE_KK; break;
+        case 0x4000: in.op = OP_SNE_KK; break;
+        case 0x5000: in.op = OP_SE_XY; break;
+        case 0x6000: in.op = OP_LD_KK; break;
+        case 0x7000: in.op = OP_ADD_KK; break;
+        case 0x8000:
+            switch(opcode & 0x000F){ // find which version of 0x8__i the opcode has
+                case 0x0: in.op = OP_LD_XY; break;
+                case 0x1: in.op = OP_OR; break;
+                case 0x2: in.op = OP_AND; break;
+                case 0x3: in.op = OP_XOR; break;
+                case 0x4: in.op = OP_ADD_XY; break;
+                case 0x5: in.op = OP_SUB; break;
+                case 0x6: in.op = OP_SHR; break;
+                case 0x7: in.op = OP_SUBN; break;
+                case 0xE: in.op = OP_SHL; break;
             }
-
             break;
-        }
-        case 0x4000:{ // 0x4xkk: SNE Vx, byte. if v[x] != kk (immediate byte) skip next instruction (pc + 2)
-            strcpy(chip->hrop, "Skip if Vx != kk\0");
-            if (chip->v[x] != (opcode & 0x00FF)) {
-                chip->pc += 4;
-            } else {
-                chip->pc += 2;
+        case 0x9000: in.op = OP_SNE_XY; break;
+        case 0xA000: in.op = OP_LD_I; break;
+        case 0xB000: in.op = OP_JP_V0; break;
+        case 0xC000: in.op = OP_RND; break;
+        case 0xD000: in.op = OP_DRW; break;
+        case 0xE000:
+            switch(opcode & 0x00FF){
+                case 0x9E: in.op = OP_SKP; break;
+                case 0xA1: in.op = OP_SKNP; break;
             }
             break;
-        }
-        case 0x5000:{ // 0x5xy0: SE Vx, Vy. if v[x] == v[y] skip next instruction (pc + 2)
-            strcpy(chip->hrop, "Skip if Vx == Vy\0");
-            if (chip->v[x] == chip->v[y]){
-                chip->pc += 4;
-            } else {
-                chip->pc += 2;
+        case 0xF000:
+            switch(opcode & 0x00FF){ // find which version of 0xF__i the opcode has
+                case 0x07: in.op = OP_LD_VDT; break;
+                case 0x0A: in.op = OP_LD_K; break;
+                case 0x15: in.op = OP_LD_DT; break;
+                case 0x18: in.op = OP_LD_ST; break;
+                case 0x1E: in.op = OP_ADD_I; break;
+                case 0x29: in.op = OP_LD_F; break;
+                case 0x33: in.op = OP_LD_B; break;
+                case 0x55: in.op = OP_LD_MEM; break;
+                case 0x65: in.op = OP_LD_REG; break;
             }
             break;
-        }
-        case 0x6000:{ // 0x6xkk: LD Vx, byte. set v[x] = kk
-            strcpy(chip->hrop, "LD byte into Vx\0");
-            chip->v[x] = (opcode & 0x00FF);
-            chip->pc += 2;
+    }
+    return in;
+}
+
+/*
+    the same for SUPER-CHIP and XO-CHIP, whose new opcodes are all holes in the CHIP-8 map.
+    XO-CHIP's 5xy2/5xy3 aren't, decode() reads those as SE Vx, Vy like the original did.
+*/
+Instr decode_for(uint16_t opcode, int variant){
+    Instr in = decode(opcode);
+    if (variant == CHIP8_VARIANT_CHIP8)
+        return in;
+    int xo = variant == CHIP8_VARIANT_XOCHIP;
+    switch (opcode & 0xF000){
+        case 0x0000:
+            if ((opcode & 0xFFF0) == 0x00C0)     in.op = OP_SCD;
+            else if (xo && (opcode & 0xFFF0) == 0x00D0) in.op = OP_SCU;
+            else if (opcode == 0x00FB) in.op = OP_SCR;
+            else if (opcode == 0x00FC) in.op = OP_SCL;
+            else if (opcode == 0x00FD) in.op = OP_EXIT;
+            else if (opcode == 0x00FE) in.op = OP_LOW;
+            else if (opcode == 0x00FF) in.op = OP_HIGH;
             break;
-        }
-        case 0x7000:{ // 0x7xkk: ADD Vx, byte. set v[x] += kk
-            strcpy(chip->hrop, "ADD Vx, byte\0");
-            chip->v[x] += (opcode & 0x00FF);
-            chip->pc += 2;
+        case 0x5000:
+            if (xo && in.n == 2)      in.op = OP_SAVE_RANGE;
+            else if (xo && in.n == 3) in.op = OP_LOAD_RANGE;
             break;
-        }
-        case 0x8000:{
-            /* fall in if its an instruction starting with 0x8___*/
-            switch(opcode & 0x000F){ // find which version of 0x8__i the opcode has
-                case 0x0:{ //0x8xy0 LD Vx, Vy. store the value in v[y] into v[x]
-                    strcpy(chip->hrop, "LD Vx, Vy. store the value in v[y] in v[x]\0");
-                    chip->v[x] = chip->v[y];
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x1:{ //0x8xy1. OR Vx, Vy. bitwise OR on the values of Vx and Vy, then store in Vx.
-                    strcpy(chip->hrop, "OR Vx, Vy. bitwise OR on the values of Vx and Vy, then store in Vx.\0");
-                    chip->v[x] = chip->v[x] | chip->v[y];
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x2:{ //0x8xy2. AND Vx, Vy. bitwise AND on the values of Vx and Vy, then store in Vx
-                    strcpy(chip->hrop, "AND Vx, Vy. bitwise AND on the values of Vx and Vy, then store in Vx\0");
-                    chip->v[x] = chip->v[x] & chip->v[y]; 
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x3:{ //0x8xy3. XOR Vx, Vy. bitwise Exclusive OR on the values of Vx and Vy. then store in Vx.
-                    strcpy(chip->hrop, "XOR Vx, Vy. bitwise Exclusive OR on the values of Vx and Vy. then store in Vx.\0");
-                    chip->v[x] = chip->v[x] ^ chip->v[y];
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x4:{ //0x8xy4. ADD Vx, Vy
-                    /* 
-                        ADD Vx, Vy. Add values in both registers and if the result if greater than 8 bits 
-                        VF is set to 1, otherwise 0. the lowest 8bits are stored in Vx.
-                    */
-                    strcpy(chip->hrop, "ADD Vx, Vy\0");
-                    uint16_t sum = chip->v[x] + chip->v[y];
+        case 0xF000:
+            if (xo && opcode == 0xF000)      in.op = OP_LD_I_LONG;
+            else if (xo && opcode == 0xF002) in.op = OP_AUDIO;
+            else if (xo && (opcode & 0xFF) == 0x01) in.op = OP_PLANE;
+            else if (xo && (opcode & 0xFF) == 0x3A) in.op = OP_PITCH;
+            else if ((opcode & 0xFF) == 0x30) in.op = OP_LD_HF;
+            else if ((opcode & 0xFF) == 0x75) in.op = OP_LD_R;
+            else if ((opcode & 0xFF) == 0x85) in.op = OP_LD_RV;
+            break;
+    }
+    return in;
+}
 
-                    // set Vf to 1 if sum > 0xFF (255) or 0 if sum < 0xFF
-                    chip->v[0xF] = sum > 0xFF;
+static inline uint16_t mem_op(const Chip8 *chip, uint16_t addr){
+    return mem_read(chip, addr) << 8 | mem_read(chip, addr + 1);
+}
 
-                    // store the lower 8 bits of sum into Vx
-                    chip->v[x] = sum & 0xFF;
+/*
+    idle loops. lots of roms wait for the delay timer with
 
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x5:{ //0x8xy5. SUB Vx, Vy
-                    /*
-                        SUB Vx - Vy. if Vx > Vy then Vf is set to 1, otherwise 0. then Vy subtracted from Vx
-                        result stored in Vx.
-                    */
-                    strcpy(chip->hrop, "SUB Vx, Vy, set Vf = NOT borrow\0");
-                    // // set Vf to 1 if Vx > Vy, otherwise set Vf to 0
-                    chip->v[0xF] = chip->v[x] >= chip->v[y];
-                    
-                    // subtract Vy from Vx, store difference in Vx
-                    chip->v[x] = chip->v[x] - chip->v[y];
-                    
-                    chip->pc += 2;
+        A:   Fx07        LD Vx, DT
+        A+2: 3xkk/4xkk   SE/SNE Vx, kk
+        A+4: 1A          JP A
 
-                    break;
-                }
-                case 0x6:{ //0x8xy6. SHR Vx {, Vy}
-                    /*
-                        set Vx = Vx SHR 1.
-                        if least-sig bit of Vx is 1, then VF is set to 1, otherwise 0. then Vx is divided by 2
-                    */
-                    strcpy(chip->hrop, "SHR Vx {, Vy}. Vx = Vx SHR 1\0");
-                    chip->v[0xF] = chip->v[x] & 0x1;
-                    chip->v[x] >>= 1;
-                    // chip->v[x] /= 2;
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x7:{// SUBN Vx, Vy, set VF = NOT borrow.
-                    /*
-                        set Vx = Vy - Vx. if Vy > Vx, then Vf is set to 1, otherwise 0. then Vx is subtracted from Vy,
-                        result stored in Vx.
-                    */
-                    strcpy(chip->hrop, "SUBN Vx, Vy, set Vf = NOT borrow\0");
-
-                    // set Vf to 1 if Vy > Vx, otherwise set to 0
-                    chip->v[0xF] = chip->v[y] >= chip->v[x];
-                    
-                    // set Vx = Vy - Vx
-                    chip->v[x] = chip->v[y] - chip->v[x];
-
-                    chip->pc +=2;
-                    break;
-                }
-                case 0xE:{// SHL Vx {, Vy}
-                    /*
-                        set Vx = Vx SHL 1. if most-sig bit of Vx is 1, then VF is set to 1, otherwise 0.
-                        then Vx is multiplied by 2.
-                    */
-                    strcpy(chip->hrop, "SHL Vx {, Vy}. Vx = Vx SHL 1\0");
-                    // set Vf to the left-most digit. (mask all but the left most bit, then shift it to right-most bit) 
-                    chip->v[0xF] = (chip->v[x] & 0x80) >> 7;
-
-                    chip->v[x] <<= 1; // shit left by 1 (aka multiply by 2)
-
-                    chip->pc += 2;
-                    break;
-                }
-            }
-            break;
-        } // end of 0x8000 instructions
-        case 0x9000:{ // SNE Vx, Vy. skip next instr. if  Vx != Vy. if true increase pc + 2
-            if (chip->v[x] != chip->v[y]){
-                chip->pc += 4;
-                break;
-            }
-            chip->pc += 2;
-            break;
-        }
-        case 0xA000:{ // LD I, Addr. set the Value of register I to nnn
-            strcpy(chip->hrop, "LD I, Addr\0");
-            chip->I  = opcode & 0x0FFF;
-            chip->pc += 2;
-            break;
-        }
-        case 0xB000:{ // JP V0, addr. pc is set to nnn plus the value in V0.
-            chip->pc = (opcode & 0x0FFF) + chip->v[0];
-            break;
-        }
-        case 0xC000:{// RND Vx, byte. set Vx = random byte AND kk. 
-            /*
-                interpreter generates a random number from 0 to 255, which is ANDed with kk, the rrsult is stored in Vx.
-            */
-            //TODO:
-            srand(time(NULL));
-            uint8_t r = rand() % 255; // random number from 0 - 255
-            
-            // r & kk
-            chip->v[x] = r & (opcode & 0x00FF);
-            
-            chip->pc += 2;
-            break;
-        }
-        case 0xD000:
-			{
-				/* DRW, Vx, Vy, nibble */
-                strcpy(chip->hrop,"DRW Vx, Vy, nibble\0");
-				unsigned char width = 8;
-				unsigned char height = opcode & 0xF;
-				int row, col;
-				chip->v[0xF] = 0;
-				for (row = 0; row < height; row++) {
-					uint8_t sprite = chip->memory[chip->I + row];
-					for (col = 0; col < width; col++) {
-						if ((sprite & 0x80) > 0) {
-							if (flippix(chip, chip->v[x] + col, chip->v[y] + row))  {
-								chip->v[0xF] = 1; // Vf is v[0xF]
-								/* if register 0xF is set to 1, collision happened */
-							}
-						}
-						sprite <<= 1;
-					}
-				}
-                chip->pc += 2;
-			}
-			break;
-        // case 0xD000: { // DRW Vx, Vy, nibble (DxyN)
-        //     /*
-        //         display n-byte sprite starting at memory location I at (vx, vy), set VF = Collision.
-
-        //         The interpreter reads n bytes from memory, starting at the address stored in I. 
-        //         these bytes are then displayed as sprites on the screeen at coordinates (Vx, Vy). 
-        //         sprites are XORed onto the existing screen. if this causes any pixeles
-        //         to be erased, VF is set to 1, otherwise it is set to 0. if the sprite is positioned so 
-        //         part of it is outside the coordinates of the display it wraps around to the opposite side of the screen.
-        //     */
-        //     //TODO:
-        //     chip->v[0xf] = 0;
-        //     uint8_t s_width = 8;                    // sprite width
-        //     uint8_t s_height = (opcode & 0x000F);   // sprite height
-        //     int row, col; // x & y coordinate of screen
-        //     for (row = 0; row < s_height; row++){
-        //         uint8_t sprite_row = chip->memory[chip->I + row];
-        //         for(col = 0; col < s_width; col++){
-        //             if((sprite_row & 0x80) > 0){
-        //                 if(flippix(chip, chip->v[x]+row, chip->v[y] + col)){
-        //                     chip->v[0xf] = 1;
-        //                 }
-        //             }
-        //             sprite_row <<= 1;
-        //         }
-        //     }
-        // }
-        // break;
-        case 0xE09E: { // SKP Vx. skip next instr. if key with value stored in Vx is pressed.
-            /*
-                Cheaks the keyboard, if the key corresponding to the values of Vx is currently
-                in the down position, pc is increased by 2.
-            */
-            // TODO:
-            break;
-        }
-        case 0xE0A1:{ // SKPN Vx. skip instr. if key with values in Vx not pressed
-            /*
-                checks keyboard, and if the key corresponding to the value of Vx is currently 
-                in the up position. pc is increased by 2.
-            */
-            // TODO:
-            break;
-        }
-        case 0xF000:{
-            /* fall in if opcode is an instruction starting with 0xF___*/
-            switch(opcode & 0x00FF){  // find which version of 0xF__i the opcode has
-                case 0x0007:{ // LD Vx, DT. set Vx = Delay Timer value.
-                    //TODO:
-                    break;
-                }
-                case 0x000A: {// LD Vx, K
-                    /*
-                        wait for a key press, store the value of the key into Vx.
-                        All execution stops until a key is pressedm then the value of that key is stored in Vx.
-                    */
-                    // TODO:
-                    chip->pc+=2;
-                    break;
-                }
-                case 0x0015:{ // LD DT, Vx. set Delay timer = Vx.
-                    //TODO:
-                    break;
-                }
-                case 0x0018:{ // LD ST, Vx. set Sound Timer = Vx.
-                    // TODO:
-                    break;
-                }
-                case 0x001E: { // ADD I, Vx, set I += Vx.
-                    strcpy(chip->hrop,"ADD I, Vx, set I += Vx.\0");
-                    chip->I += chip->v[x];
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x0029: { // LD F, Vx. set I = location of sprite for digit Vx.
-                    /*
-                        the value of I is set to the location for the hexadecimal sprite corresponding to the value
-                        of Vx. 
-                    */
-                    strcpy(chip->hrop,"LD F, Vx. load hex font into I\0");
-                    chip->I = chip->v[x] * 5;
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x0033:{ // LD B, Vx. store BCD representation of Vx in memory location I, I+1, and I+2.
-                    /*
-                        the interpreter takes the decimal value of Vx, and places the hundreds digit in memory location at I,
-                        the tens digit at memory location I+1, and the ones digit in location I+2.
-                    */
-                    strcpy(chip->hrop,"LD B, Vx. store BCD representation of Vx in memory location I, I+1, and I+2.\0");
-                    uint8_t n = chip->v[x];
-                    // for (int i = chip->I + 2; i > 0; i--){
-                    //     chip->memory[i] = n % 10;
-                    //     n /= 10;
-                    // }
-
-                    // chip->pc += 2;
-
-
-                    chip->memory[chip->I] = (chip->v[x] / 100) % 10;
-					chip->memory[chip->I+1] = (chip->v[x] / 10) % 10;
-					chip->memory[chip->I+2] = (chip->v[x] % 10);
-                    chip->pc += 2;
-                    printf("memory[%x]: %d ", chip->I, chip->memory[chip->I]);
-                    printf("memory[%x]: %d ", chip->I+1, chip->memory[chip->I+1]);
-                    printf("memory[%x]: %d ", chip->I+2, chip->memory[chip->I+2]);
-                    
-
-                    
-                    break;
-                }
-                case 0x0055:{ // LD [I], Vx. store register V0 through Vx in memory starting at location I.
-                    /*
-                        the interpreser copies the vaues of resgisters V0 -> Vx into memory, starting at the address in I.
-                    */
-                    strcpy(chip->hrop,"LD [I], Vx. store register V0 through Vx into memory starting at I\0");
-                    uint8_t i;
-                    for(i = 0x0; i <= x; i++){
-                        chip->memory[chip->I+i] = chip->v[i];
-                    }
-                    chip->pc += 2;
-                    break;
-                }
-                case 0x0065:{ // LD Vx, [I]
-                    /*
-                        Read Registers V0 -> Vx from memory starting at location I.
-                        the inerpreter reads values from memory starting at locaiton I into registers V0 -> Vx.
-                    */
-                    strcpy(chip->hrop,"LD Vx, [I] load register V0 -> Vx from memory starting at I\0");
-                    uint8_t i;
-                    for(i = 0; i <= x; i++){
-                        chip->v[i] = chip->memory[chip->I + i];
-                    }
-                    chip->pc += 2;
-                    break;
-                }
-            }
+    nothing but the timer changes while one spins, so chip8_run_timed() skips whole ticks of
+    it at once (see idle_skip()). decode_at() turns the Fx07 at the head of such a loop into
+    OP_WAIT_DT, which runs exactly like OP_LD_VDT and is only there to mark the pattern:
+    y is 1 for SE (spin until Vx == kk) and 0 for SNE (spin while Vx == kk), nnn is kk.
+    mem_write() sends it back to OP_DECODE when any of the six bytes changes.
+*/
+static Instr decode_at(const Chip8 *chip, uint16_t pc){
+    Instr in = decode_for(mem_op(chip, pc), chip->variant);
+    if (in.op == OP_LD_I_LONG)
+        in.nnn = mem_op(chip, pc + 2);
+    if (in.op == OP_LD_VDT && pc <= MEMORY_SIZE - 6){
+        uint16_t test = mem_op(chip, pc + 2), jump = mem_op(chip, pc + 4);
+        if (((test & 0xF000) == 0x3000 || (test & 0xF000) == 0x4000)
+            && ((test >> 8) & 0xF) == in.x && jump == (0x1000 | (pc & MEM_MASK))){
+            in.op = OP_WAIT_DT;
+            in.y = (test & 0xF000) == 0x3000;
+            in.nnn = test & 0xFF;
         }
+    }
+    return in;
+}
+
+/*
+    rom images. a chip's memory and decoded ops start out as the pages of an immutable image:
+    the fonts, the rom at 0x200, zeros, and every address of that decoded. images are hashed
+    and kept in a process-wide cache, so every instance of the same rom, on any thread,
+    shares one. the cache is direct mapped on the hash, a rom landing on a taken slot pushes
+    the old image out; images are reference counted (the cache's plus one per chip using
+    it) and freed when the last of those lets go.
+*/
+#include <pthread.h>
+
+#define ROM_CACHE_SLOTS 256         // power of two
+
+typedef struct RomImage {
+    uint64_t        hash;
+    size_t          size;
+    int             refs;           // under rom_cache_lock
+    int             variant;        // the machine it was laid out and decoded for
+    uint8_t         *memory;        // memory_size() of each, in the same allocation
+    Instr           *decoded;
+} RomImage;
 
+static inline size_t memory_size(int variant){
+    return variant == CHIP8_VARIANT_XOCHIP ? XO_MEMORY_SIZE : MEMORY_SIZE;
+}
+
+static RomImage *rom_cache[ROM_CACHE_SLOTS];
+static pthread_mutex_t rom_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t rom_hash(const uint8_t *rom, size_t size){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++){
+        h ^= rom[i];
+        h *= 0x100000001b3ULL;
     }
-    
+    return h;
 }
 
-Chip8* chip8_init(){
-    Chip8 *chip = (Chip8*)malloc(sizeof(Chip8));
-    loadfonts(chip);
-    // print_emulator_memory_space(chip);
-    chip->pc = 0x200;
-    // chip->I = 0x200;
-    // chip->opcode = 0x0;
-    chip->sp = 0;
-    // init_mem(chip);
-    // clear_screen(chip);
+static void rom_image_put(RomImage *img){
+    pthread_mutex_lock(&rom_cache_lock);
+    int last = --img->refs == 0;
+    pthread_mutex_unlock(&rom_cache_lock);
+    if (last)
+        free(img);
+}
 
-    return chip;
+// view is a chip whose pages are img's, to decode it through. an XO-CHIP view needs an ext
+static void image_view(Chip8 *view, RomImage *img){
+    view->variant = img->variant;
+    view->mask = memory_size(img->variant) - 1;
+    view->pages = memory_size(img->variant) / MEM_PAGE_SIZE;
+    for (int p = 0; p < view->pages; p++)
+        MEM_TAB(view, view->mask)[p] = img->memory + p * MEM_PAGE_SIZE;
 }
 
-void printState(Chip8 *chip){
-    print_screen_debug(chip);
-    // printf("opcode: 0x%04x --> %s\n", chip->opcode, chip->hrop);
-    // printf("PC:     0x%x\n", chip->pc);
-    // printf("I:      0x%x\n", chip->I);
-    // printf("sp:     %x\n", chip->sp);
-    // printf("Vf:     0x%04x\n", chip->v[0xF]);
-    // printf("instr at pc: 0x%02x%02x\n", chip->memory[chip->pc], chip->memory[chip->pc+1] );
-    // print_filled_registers(chip);
-    // print_stack(chip);
-    // print_rom_in_memory(chip);
-    
+static RomImage *rom_image_build(uint64_t hash, const uint8_t *rom, size_t size, int variant){
+    size_t bytes = memory_size(variant);
+    RomImage *img = (RomImage*)calloc(1, sizeof(RomImage) + bytes * (1 + sizeof(Instr)));
+    if (img == NULL)
+        return NULL;
+    img->hash = hash;
+    img->size = size;
+    img->refs = 1;
+    img->variant = variant;
+    img->decoded = (Instr*)(img + 1);
+    img->memory = (uint8_t*)(img->decoded + bytes);
+    loadfonts(img->memory);
+    if (variant != CHIP8_VARIANT_CHIP8)
+        memcpy(img->memory + BIG_FONT, big_fonts, sizeof(big_fonts));
+    memcpy(img->memory + 0x200, rom, size);
+    Chip8 view;
+    struct Ext ext;
+    view.ext = &ext;
+    image_view(&view, img);
+    for (size_t i = 0; i < bytes; i++)
+        img->decoded[i] = decode_at(&view, i);
+    return img;
 }
 
+/* the image of rom for variant, with a reference held for the caller. NULL if out of memory */
+static RomImage *rom_image_get(const uint8_t *rom, size_t size, int variant){
+    uint64_t hash = rom_hash(rom, size) ^ variant;
+    pthread_mutex_lock(&rom_cache_lock);
+    RomImage **slot = &rom_cache[hash & (ROM_CACHE_SLOTS - 1)], *img = *slot;
+    if (img != NULL && img->hash == hash && img->size == size && img->variant == variant
+        && memcmp(img->memory + 0x200, rom, size) == 0)
+        img->refs++;
+    else
+        img = NULL;
+    pthread_mutex_unlock(&rom_cache_lock);
+    if (img != NULL)
+        return img;
 
+    if ((img = rom_image_build(hash, rom, size, variant)) == NULL)
+        return NULL;
+    pthread_mutex_lock(&rom_cache_lock);
+    RomImage *old = *slot;
+    if (old != NULL && old->hash == hash && old->size == size && old->variant == variant){
+        old = NULL;                 // another thread got there first, keep theirs cached
+    } else {
+        *slot = img;
+        img->refs++;
+    }
+    pthread_mutex_unlock(&rom_cache_lock);
+    if (old != NULL)
+        rom_image_put(old);
+    return img;
+}
 
-int load_rom(Chip8 *chip, char* path){
-    FILE *rom = NULL;
-    size_t rom_size;
-    size_t read_size;
-    uint8_t *rom_buff;
+static void fuse_all(Chip8 *chip);
+static void jit_reload(Chip8 *chip);
+static void debug_remark(Chip8 *chip);
 
-    rom = fopen(path, "rb");
-    if(rom == NULL){
-        fprintf(stderr, "%s","Error: could not open file in <path>" );
-        exit(1);
+/* drop chip's own pages, all of its memory goes back to being the image's */
+static void mem_revert(Chip8 *chip){
+    uint8_t **mem = MEM_TAB(chip, chip->mask);
+    Instr **code = CODE_TAB(chip, chip->mask);
+    uint64_t *own_mem = OWN_MEM(chip, chip->mask), *own_code = OWN_CODE(chip, chip->mask);
+    for (int p = 0; p < chip->pages; p++){
+        if (OWNS(own_mem, p))
+            free(mem[p]);
+        if (OWNS(own_code, p))
+            free(code[p]);
+        mem[p] = chip->image->memory + p * MEM_PAGE_SIZE;
+        code[p] = chip->image->decoded + p * MEM_PAGE_SIZE;
     }
+    memset(own_mem, 0, (chip->pages + 63) / 64 * sizeof(uint64_t));
+    memset(own_code, 0, (chip->pages + 63) / 64 * sizeof(uint64_t));
+}
+
+/* give back chip's own pages and its image */
+static void mem_release(Chip8 *chip){
+    if (chip->image == NULL)
+        return;
+    mem_revert(chip);
+    rom_image_put(chip->image);
+    chip->image = NULL;
+}
 
-    fseek(rom, 0, SEEK_END);
-    rom_size = ftell(rom);
-    rewind(rom);
+/* point all of chip's pages at img, whose reference chip now holds. chip becomes img's machine */
+static void mem_attach(Chip8 *chip, RomImage *img){
+    mem_release(chip);
+    chip->image = img;
+    image_view(chip, img);
+    mem_revert(chip);
+    if (chip->jit != NULL)
+        jit_reload(chip);
+    if (chip->fuse)
+        fuse_all(chip);
+    if (chip->debug != NULL)
+        debug_remark(chip);
+}
 
-    rom_buff = (uint8_t *)malloc(sizeof(rom_size));
-    if(rom_buff == NULL){
-        fprintf(stderr, "%s", "Error: allocating memory for rom");
+/* copy page p of memory (mem_own) or of decoded ops (code_own) before the first write to it */
+static __attribute__((noinline, cold)) void page_own(void **page, uint64_t *own, int p, size_t size){
+    void *copy = malloc(size);
+    if (copy == NULL){
+        fprintf(stderr, "%s", "Error: allocating a memory page\n");
         exit(1);
     }
+    memcpy(copy, page[p], size);
+    page[p] = copy;
+    own[p >> 6] |= 1ULL << (p & 63);
+}
 
-    read_size = fread(rom_buff, sizeof(uint8_t), (size_t) rom_size, rom);
-    if(read_size != rom_size){
-        fprintf(stderr, "%s", "Error: reading rom into rom buffer");
-        exit(1);
+static inline void mem_own(Chip8 *chip, int p, uint16_t mask){
+    if (!OWNS(OWN_MEM(chip, mask), p))
+        page_own((void**)MEM_TAB(chip, mask), OWN_MEM(chip, mask), p, MEM_PAGE_SIZE);
+}
+
+static inline void code_own(Chip8 *chip, int p, uint16_t mask){
+    if (!OWNS(OWN_CODE(chip, mask), p))
+        page_own((void**)CODE_TAB(chip, mask), OWN_CODE(chip, mask), p, MEM_PAGE_SIZE * sizeof(Instr));
+}
+
+static inline void code_drop(Chip8 *chip, uint16_t addr, uint16_t mask){
+    if (code_at_m(chip, addr, mask)->op != OP_DECODE){
+        code_own(chip, PAGE_M(addr, mask), mask);
+        code_at_m(chip, addr, mask)->op = OP_DECODE;
+    }
+}
+
+// superinstructions and debugger marks (which may stand for an idle loop head or F000 nnnn)
+// reach further back than anything else, and only chips with fusion on or a debugger have any
+static __attribute__((noinline)) void span_drop(Chip8 *chip, uint16_t addr, uint16_t mask){
+    for (int k = 2; k < 2 * FUSE_MAX; k++)
+        if (k < op_span[code_at_m(chip, addr - k, mask)->op])
+            code_drop(chip, addr - k, mask);
+}
+
+/*
+    the only way instructions write guest memory. drops the two cached ops that overlap addr,
+    any op further back that was decoded from it too (idle loop heads, F000 nnnn,
+    superinstructions, see op_span[]), and any compiled code built from it.
+*/
+static inline __attribute__((always_inline))
+void mem_write_m(Chip8 *chip, uint16_t addr, uint8_t val, uint16_t mask){
+    addr &= mask;
+    mem_own(chip, PAGE_M(addr, mask), mask);
+    MEM_TAB(chip, mask)[PAGE_M(addr, mask)][OFFSET(addr)] = val;
+    code_drop(chip, addr, mask);
+    code_drop(chip, addr - 1, mask);
+    for (int k = 2; k <= 5; k++){
+        uint8_t op = code_at_m(chip, addr - k, mask)->op;
+        if (op == OP_WAIT_DT || (mask == XO_MASK && op == OP_LD_I_LONG && k <= 3))
+            code_drop(chip, addr - k, mask);
+    }
+    if (chip->fuse || chip->debug != NULL)
+        span_drop(chip, addr, mask);
+    if (chip->code_map != NULL && chip->code_map[addr])
+        chip->code_write(chip, addr);
+}
+
+static inline void mem_write(Chip8 *chip, uint16_t addr, uint8_t val){
+    mem_write_m(chip, addr, val, chip->mask);
+}
+
+/*
+    fusing. fuse_at() looks at one address: if an idiom the chip has on starts there, the op
+    there becomes its OP_FUSE_*, keeping the fields it was decoded with. what comes after it
+    has to be decoded for the fused op to read, so that gets done too. mem_write() drops the
+    fused op with the rest when any byte of the idiom changes (op_span[]), and run_core()
+    fuses it again when it decodes it.
+*/
+static void fuse_at(Chip8 *chip, uint16_t pc){
+    if (chip->debug != NULL)
+        return;                 // it would run past the debugger's marks, see debug_mark()
+    pc &= chip->mask;
+    uint8_t op = op_base(code_at(chip, pc)->op);
+    for (int i = 0; i < IDIOMS; i++){
+        const Idiom *id = &idioms[i];
+        if (!(chip->fuse >> i & 1) || op != id->ops[0] || OFFSET(pc) + 2 * (id->len - 1) >= MEM_PAGE_SIZE)
+            continue;
+        int j;
+        for (j = 1; j < id->len; j++){
+            const Instr *in = code_at(chip, pc + 2 * j);
+            uint8_t next = in->op == OP_DECODE ? decode_at(chip, pc + 2 * j).op : op_base(in->op);
+            if (next != id->ops[j])
+                break;
+        }
+        if (j < id->len)
+            continue;
+        if (code_at(chip, pc)->op == id->fused)
+            return;
+        code_own(chip, PAGE_M(pc, chip->mask), chip->mask);
+        for (j = 1; j < id->len; j++)
+            if (code_at(chip, pc + 2 * j)->op == OP_DECODE)
+                *code_at(chip, pc + 2 * j) = decode_at(chip, pc + 2 * j);
+        code_at(chip, pc)->op = id->fused;
+        return;
+    }
+}
+
+/* fuse all of memory over again for the idioms chip has on now */
+static void fuse_all(Chip8 *chip){
+    // only pages of our own hold fused ops, unfusing never copies one
+    for (uint32_t pc = 0; pc <= chip->mask; pc++){
+        Instr *in = code_at(chip, pc);
+        if (in->op != op_base(in->op))
+            in->op = op_base(in->op);
     }
+    for (uint32_t pc = 0; pc <= chip->mask; pc++)
+        fuse_at(chip, pc);
+}
+
+/*
+    op pairs and triples, counted by op (as decoded, before any fusing) over instructions that
+    ran one straight after the other. an idiom's weight is the count of its pair, or of the
+    least run of its triples, and fuse_pick() turns on every idiom weighing in at least
+    FUSE_SHARE of everything that ran.
+*/
+#define FUSE_SHARE  0.01
 
-    if (rom_size > MAX_ROM_SIZE){
-        fprintf(stderr, "%s", "Error: rom size larger than available space");
+typedef struct Grams {
+    uint64_t        total;              // instructions counted
+    uint64_t        warmup;             // total at which the chip gets fused
+    uint16_t        pc;                 // the last instruction
+    uint8_t         op[2];              // the last two ops, op[0] the latest
+    uint8_t         run;                // how many of those ran straight before this one, 0-2
+    uint64_t        pairs[OP_COUNT][OP_COUNT];
+    uint32_t        triples[OP_COUNT][OP_COUNT][OP_COUNT];
+} Grams;
+
+static uint64_t idiom_weight(const Grams *g, const Idiom *id){
+    if (id->len == 2)
+        return g->pairs[id->ops[0]][id->ops[1]];
+    uint64_t w = UINT64_MAX;
+    for (int j = 0; j + 2 < id->len; j++){
+        uint64_t t = g->triples[id->ops[j]][id->ops[j + 1]][id->ops[j + 2]];
+        if (t < w)
+            w = t;
     }
-    else{
-        memcpy(chip->memory+0x200, rom_buff, rom_size);
-        chip->rom_size = rom_size;
+    return w;
+}
+
+static uint8_t fuse_pick(const Grams *g){
+    uint8_t fuse = 0;
+    for (int i = 0; i < IDIOMS; i++){
+        uint64_t w = idiom_weight(g, &idioms[i]);
+        if (w != 0 && w >= FUSE_SHARE * g->total)
+            fuse |= 1 << i;
     }
+    return fuse;
+}
+
+// the warmup is over: fuse what was hot and stop counting. chip8_run() checks between runs
+static __attribute__((noinline, cold)) void fuse_warm(Chip8 *chip){
+    Trace *t = chip->trace;
+    chip->trace = NULL;
+    free(t);
+    chip->fuse = fuse_pick(chip->grams);
+    fuse_all(chip);
+}
+
+// on the trace hook while a chip warms up. it only counts: anything it called, the
+// interpreter would spill registers around on every path, hook or no hook
+static void gram_record(Chip8 *chip, uint16_t pc, const Instr *in){
+    Grams *g = chip->grams;
+    uint8_t op = op_base(in->op);
+    g->run = g->total != 0 && pc == (uint16_t)(g->pc + 2) ? (g->run < 2 ? g->run + 1 : 2) : 0;
+    if (g->run >= 1)
+        g->pairs[g->op[0]][op]++;
+    if (g->run >= 2)
+        g->triples[g->op[1]][g->op[0]][op]++;
+    g->op[1] = g->op[0];
+    g->op[0] = op;
+    g->pc = pc;
+    g->total++;
+}
 
-    fclose(rom);
-    free(rom_buff);
+static Grams *grams_get(Chip8 *chip){
+    if (chip->grams == NULL && (chip->grams = (Grams*)calloc(1, sizeof(Grams))) == NULL)
+        fprintf(stderr, "%s", "Error: allocating op counts\n");
+    return chip->grams;
+}
 
+/*
+    turn fusion on. the interpreter counts op pairs and triples for the next `warmup`
+    instructions (through the trace hook, so it can't be tracing meanwhile) and fuses the
+    idioms that were hot once chip8_run() gets back to its timer bookkeeping after that,
+    within a tick; warmup 0 fuses every idiom right away. built with CHIP8_NO_TRACE
+    there's no hook to count on and every idiom is fused. 0 if it can't.
+*/
+int chip8_fuse(Chip8 *chip, uint64_t warmup){
+#ifdef CHIP8_NO_TRACE
+    warmup = 0;
+#endif
+    if (warmup == 0){
+        chip->fuse = (1 << IDIOMS) - 1;
+        fuse_all(chip);
+        return 1;
+    }
+    if (chip->trace != NULL || grams_get(chip) == NULL)
+        return 0;
+    if ((chip->trace = (Trace*)calloc(1, sizeof(Trace))) == NULL){
+        fprintf(stderr, "%s", "Error: allocating op counts\n");
+        return 0;
+    }
+    chip->trace->grams = chip->grams;
+    chip->grams->warmup = chip->grams->total + warmup;
     return 1;
 }
 
+static int op_named(const char *name){
+    for (int op = 0; op < OP_COUNT; op++)
+        if (strcmp(op_names[op] + 3, name) == 0)
+            return op;
+    return -1;
+}
 
+/* write the counts fusion was picked from, one "count op op [op]" line each */
+int chip8_fuse_save(const Chip8 *chip, const char *path){
+    const Grams *g = chip->grams;
+    if (g == NULL || g->total == 0){
+        fprintf(stderr, "%s", "Error: no op counts to save, nothing warmed up\n");
+        return 0;
+    }
+    FILE *f = fopen(path, "w");
+    if (f == NULL){
+        fprintf(stderr, "Error: could not open %s\n", path);
+        return 0;
+    }
+    fprintf(f, "# chip8 op pairs and triples that ran back to back, see chip8_fuse()\n");
+    fprintf(f, "# fused:");
+    for (int i = 0; i < IDIOMS; i++)
+        if (chip->fuse >> i & 1)
+            fprintf(f, " %s%s", idioms[i].name, chip->fuse >> (i + 1) ? "," : "");
+    fprintf(f, "\n%llu total\n", (unsigned long long)g->total);
+    for (int a = 0; a < OP_COUNT; a++)
+        for (int b = 0; b < OP_COUNT; b++){
+            if (g->pairs[a][b] != 0)
+                fprintf(f, "%llu %s %s\n", (unsigned long long)g->pairs[a][b], op_names[a] + 3, op_names[b] + 3);
+            for (int c = 0; c < OP_COUNT; c++)
+                if (g->triples[a][b][c] != 0)
+                    fprintf(f, "%llu %s %s %s\n", (unsigned long long)g->triples[a][b][c],
+                            op_names[a] + 3, op_names[b] + 3, op_names[c] + 3);
+        }
+    int ok = fclose(f) == 0;
+    if (!ok)
+        fprintf(stderr, "Error: writing %s\n", path);
+    return ok;
+}
 
-int main(){
-    Chip8 *chip = chip8_init();
-    // char *p = "IBM.ch8";
-    char *p = "Clock.ch8";
-    load_rom(chip, p);
-    while(1){
-        interpreter(chip);
-        // sleep(1);
-        // usleep(10000);
-        usleep(10000);
-        printState(chip);
-        strcpy(chip->hrop,"\0");
-        // print_screen_debug(chip);
-        printf("\n");
+/* add the counts chip8_fuse_save() wrote to chip's and fuse from them now */
+int chip8_fuse_load(Chip8 *chip, const char *path){
+    FILE *f = fopen(path, "r");
+    if (f == NULL){
+        fprintf(stderr, "Error: could not open %s\n", path);
+        return 0;
     }
-    return 0;
-}
\ No newline at end of file
+    Grams *g = grams_get(chip);
+    char line[128], name[3][32];
+    int ok = g != NULL;
+    for (int n = 1; ok && fgets(line, sizeof(line), f) != NULL; n++){
+        unsigned long long count;
+        int k = sscanf(line, "%llu %31s %31s %31s", &count, name[0], name[1], name[2]) - 1;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (k == 1 && strcmp(name[0], "total") == 0){
+            g->total += count;
+            continue;
+        }
+        int op[3];
+        for (int j = 0; j < k; j++)
+            op[j] = op_named(name[j]);
+        if (k == 2 && op[0] >= 0 && op[1] >= 0)
+            g->pairs[op[0]][op[1]] += count;
+        else if (k == 3 && op[0] >= 0 && op[1] >= 0 && op[2] >= 0)
+            g->triples[op[0]][op[1]][op[2]] += count;
+        else {
+            fprintf(stderr, "Error: %s:%d isn't a count of ops\n", path, n);
+            ok = 0;
+        }
+    }
+    fclose(f);
+    if (!ok)
+        return 0;
+    chip->fuse = fuse_pick(g);
+    fuse_all(chip);
+    return 1;
+}
+
+/*
+    debugger. nothing checks breakpoints or watchpoints as the program runs: every address a
+    point could stop at gets its decoded op swapped for OP_BREAK, which keeps the fields and
+    leaves the op it stands for in orig[]. code without a mark runs exactly as it would
+    without a debugger. what gets marked:
+    - a breakpoint, its address.
+    - a register watchpoint, every instruction that reads or writes the register (op_regs()).
+    - a memory watchpoint, every instruction that reads or writes memory through I (op_mem());
+      whether it touches the range this time is only known from I once it gets there.
+    run_core() asks debug_hit() at a mark whether to stop. a stop is before the instruction:
+    none of it has run and pc is its address; the next chip8_run() runs it without stopping
+    again. decoding an address over again (after a write, see mem_write()) marks it again.
+    superinstructions would run straight past marks, so fusion is held off while a debugger
+    is attached, and idle_skip() doesn't jump over a wait loop with a mark in it.
+*/
+#define DEBUG_POINTS    32
+#define EXPR_MAX        64              // ops in a compiled expression
+#define REG_I           (1u << 16)      // I next to V0-VF (bits 0-15) in register masks
+
+// a condition, compiled to postfix by expr_compile()
+enum { EX_NUM, EX_REG, EX_LOAD, EX_NEG, EX_NOT, EX_BNOT,
+       EX_OR, EX_AND, EX_BOR, EX_XOR, EX_BAND, EX_EQ, EX_NE, EX_LT, EX_LE, EX_GT, EX_GE,
+       EX_SHL, EX_SHR, EX_ADD, EX_SUB, EX_MUL, EX_DIV, EX_MOD };
+
+// registers an expression can name after V0-VF (0-15)
+enum { R_I = 16, R_PC, R_SP, R_DT, R_ST, R_KEYS, R_COUNT };
+static const char *expr_names[R_COUNT - R_I] = { "i", "pc", "sp", "dt", "st", "keys" };
+
+typedef struct ExprOp {
+    uint8_t         kind;               // EX_*
+    int32_t         val;                // the number, or the register
+} ExprOp;
+
+typedef struct Expr {
+    int             len;
+    ExprOp          op[EXPR_MAX];
+} Expr;
+
+// binary operators, loosest first within each length. two character ones go first so "<="
+// isn't taken for "<" and "||" for "|"
+static const struct { const char *tok; uint8_t prec, kind; } expr_binary[] = {
+    { "||", 1, EX_OR }, { "&&", 2, EX_AND }, { "==", 6, EX_EQ }, { "!=", 6, EX_NE },
+    { "<=", 7, EX_LE }, { ">=", 7, EX_GE }, { "<<", 8, EX_SHL }, { ">>", 8, EX_SHR },
+    { "|", 3, EX_BOR }, { "^", 4, EX_XOR }, { "&", 5, EX_BAND }, { "<", 7, EX_LT }, { ">", 7, EX_GT },
+    { "+", 9, EX_ADD }, { "-", 9, EX_SUB }, { "*", 10, EX_MUL }, { "/", 10, EX_DIV }, { "%", 10, EX_MOD },
+};
+#define EXPR_BINARY ((int)(sizeof(expr_binary) / sizeof(expr_binary[0])))
+
+typedef struct ExprParse {
+    const char      *s;
+    Expr            *e;
+    int             err;
+} ExprParse;
+
+static void expr_emit(ExprParse *p, uint8_t kind, int32_t val){
+    if (p->e->len == EXPR_MAX){
+        p->err = 1;
+        return;
+    }
+    p->e->op[p->e->len++] = (ExprOp){ kind, val };
+}
+
+static void expr_space(ExprParse *p){
+    while (*p->s == ' ' || *p->s == '\t')
+        p->s++;
+}
+
+static void expr_binop(ExprParse *p, int min);
+
+// a number, a register, [addr], (expr), or one of those under ! - ~
+static void expr_unary(ExprParse *p){
+    expr_space(p);
+    char c = *p->s;
+    if (p->err)
+        return;
+    if (c == '!' || c == '-' || c == '~'){
+        p->s++;
+        expr_unary(p);
+        expr_emit(p, c == '!' ? EX_NOT : c == '-' ? EX_NEG : EX_BNOT, 0);
+    } else if (c == '(' || c == '['){
+        p->s++;
+        expr_binop(p, 1);
+        expr_space(p);
+        if (*p->s != (c == '(' ? ')' : ']')){
+            p->err = 1;
+            return;
+        }
+        p->s++;
+        if (c == '[')
+            expr_emit(p, EX_LOAD, 0);
+    } else if (isdigit((unsigned char)c)){
+        char *end;
+        expr_emit(p, EX_NUM, (int32_t)strtol(p->s, &end, 0));
+        p->s = end;
+    } else if (isalpha((unsigned char)c)){
+        char word[8];
+        size_t n = 0;
+        while (isalnum((unsigned char)*p->s)){
+            if (n + 1 < sizeof(word))
+                word[n++] = tolower((unsigned char)*p->s);
+            p->s++;
+        }
+        word[n] = '\0';
+        if (n == 2 && word[0] == 'v' && isxdigit((unsigned char)word[1])){
+            expr_emit(p, EX_REG, (int32_t)strtol(word + 1, NULL, 16));
+            return;
+        }
+        for (int r = R_I; r < R_COUNT; r++)
+            if (strcmp(word, expr_names[r - R_I]) == 0){
+                expr_emit(p, EX_REG, r);
+                return;
+            }
+        p->err = 1;
+    } else {
+        p->err = 1;
+    }
+}
+
+// precedence climbing: operands and every operator at least as tight as min
+static void expr_binop(ExprParse *p, int min){
+    expr_unary(p);
+    while (!p->err){
+        expr_space(p);
+        int i;
+        for (i = 0; i < EXPR_BINARY; i++)
+            if (strncmp(p->s, expr_binary[i].tok, strlen(expr_binary[i].tok)) == 0)
+                break;
+        if (i == EXPR_BINARY || expr_binary[i].prec < min)
+            return;
+        p->s += strlen(expr_binary[i].tok);
+        expr_binop(p, expr_binary[i].prec + 1);
+        expr_emit(p, expr_binary[i].kind, 0);
+    }
+}
+
+static int expr_compile(const char *s, Expr *e){
+    ExprParse p = { s, e, 0 };
+    e->len = 0;
+    expr_binop(&p, 1);
+    expr_space(&p);
+    if (p.err || (*p.s != '\0' && *p.s != '\n')){
+        fprintf(stderr, "Error: can't make sense of \"%s\" as an expression\n", s);
+        return 0;
+    }
+    return 1;
+}
+
+static int64_t expr_reg(const Chip8 *chip, int r){
+    switch (r){
+        case R_I:    return chip->I;
+        case R_PC:   return chip->pc;
+        case R_SP:   return chip->sp;
+        case R_DT:   return chip->delayTimer;
+        case R_ST:   return chip->soundTimer;
+        case R_KEYS: return chip->keys;
+    }
+    return chip->v[r & 0xF];
+}
+
+// dividing by 0 gives 0, there's nothing else that can go wrong
+static int64_t expr_eval(const Chip8 *chip, const Expr *e){
+    int64_t stack[EXPR_MAX];
+    int sp = 0;
+    for (int i = 0; i < e->len; i++){
+        const ExprOp *op = &e->op[i];
+        switch (op->kind){
+            case EX_NUM:  stack[sp++] = op->val; continue;
+            case EX_REG:  stack[sp++] = expr_reg(chip, op->val); continue;
+            case EX_LOAD: stack[sp - 1] = mem_read(chip, (uint16_t)stack[sp - 1]); continue;
+            case EX_NEG:  stack[sp - 1] = -stack[sp - 1]; continue;
+            case EX_NOT:  stack[sp - 1] = !stack[sp - 1]; continue;
+            case EX_BNOT: stack[sp - 1] = ~stack[sp - 1]; continue;
+        }
+        int64_t b = stack[--sp], a = stack[sp - 1], r = 0;
+        switch (op->kind){
+            case EX_OR:   r = a || b; break;
+            case EX_AND:  r = a && b; break;
+            case EX_BOR:  r = a | b; break;
+            case EX_XOR:  r = a ^ b; break;
+            case EX_BAND: r = a & b; break;
+            case EX_EQ:   r = a == b; break;
+            case EX_NE:   r = a != b; break;
+            case EX_LT:   r = a < b; break;
+            case EX_LE:   r = a <= b; break;
+            case EX_GT:   r = a > b; break;
+            case EX_GE:   r = a >= b; break;
+            case EX_SHL:  r = (int64_t)((uint64_t)a << (b & 63)); break;
+            case EX_SHR:  r = a >> (b & 63); break;
+            case EX_ADD:  r = a + b; break;
+            case EX_SUB:  r = a - b; break;
+            case EX_MUL:  r = a * b; break;
+            case EX_DIV:  r = b != 0 ? a / b : 0; break;
+            case EX_MOD:  r = b != 0 ? a % b : 0; break;
+        }
+        stack[sp - 1] = r;
+    }
+    return sp != 0 ? stack[0] : 0;
+}
+
+enum { POINT_NONE, POINT_BREAK, POINT_REG, POINT_MEM };
+
+typedef struct DebugPoint {
+    uint8_t         kind;               // POINT_*
+    uint8_t         rw;                 // CHIP8_DEBUG_READ/WRITE, watchpoints
+    uint8_t         cond_set;           // stop only while cond is nonzero
+    uint32_t        regs;               // POINT_REG: V0-VF, REG_I
+    uint16_t        lo, hi;             // POINT_BREAK: lo is the address. POINT_MEM: the range
+    uint64_t        hits;
+    Expr            cond;
+    char            text[96];           // as it was asked for
+} DebugPoint;
+
+typedef struct Debug {
+    DebugPoint      points[DEBUG_POINTS]; // a point's id is its index + 1
+    int             stop;               // the point chip8_run() stopped at, until chip8_debug_stopped()
+    int32_t         pass;               // where it stopped, that runs once without stopping. or -1
+    Instr           run;                // what OP_BREAK runs in place of itself, see debug_hit()
+    uint8_t         orig[XO_MEMORY_SIZE]; // the op each marked address was decoded as
+} Debug;
+
+static uint32_t reg_range(int a, int b){
+    if (a > b){
+        int t = a;
+        a = b;
+        b = t;
+    }
+    return (uint32_t)((2ULL << b) - (1ULL << a));
+}
+
+// the registers an instruction reads and writes on chip's machine, V0-VF and REG_I
+static void op_regs(const Chip8 *chip, const Instr *in, uint32_t *reads, uint32_t *writes){
+    int xo = chip->variant == CHIP8_VARIANT_XOCHIP, schip = chip->variant == CHIP8_VARIANT_SCHIP;
+    uint32_t x = 1u << in->x, y = 1u << in->y, f = 1u << 0xF, r = 0, w = 0;
+    switch (in->op){
+        case OP_SE_KK: case OP_SNE_KK: case OP_SKP: case OP_SKNP:
+        case OP_LD_DT: case OP_LD_ST: case OP_PITCH:
+            r = x; break;
+        case OP_SE_XY: case OP_SNE_XY:
+            r = x | y; break;
+        case OP_LD_KK: case OP_RND: case OP_WAIT_DT: case OP_LD_VDT: case OP_LD_K:
+            w = x; break;
+        case OP_ADD_KK:
+            r = w = x; break;
+        case OP_LD_XY:
+            r = y; w = x; break;
+        case OP_OR: case OP_AND: case OP_XOR:
+            r = x | y; w = x; break;
+        case OP_ADD_XY: case OP_SUB: case OP_SUBN:
+            r = x | y; w = x | f; break;
+        case OP_SHR: case OP_SHL:
+            r = xo ? y : x; w = x | f; break;
+        case OP_LD_I: case OP_LD_I_LONG:
+            w = REG_I; break;
+        case OP_JP_V0:
+            r = schip ? x : 1; break;
+        case OP_DRW:
+            r = x | y | REG_I; w = f; break;
+        case OP_ADD_I:
+            r = x | REG_I; w = REG_I; break;
+        case OP_LD_F: case OP_LD_HF:
+            r = x; w = REG_I; break;
+        case OP_LD_B:
+            r = x | REG_I; break;
+        case OP_LD_MEM:
+            r = reg_range(0, in->x) | REG_I; w = xo ? REG_I : 0; break;
+        case OP_LD_REG:
+            r = REG_I; w = reg_range(0, in->x) | (xo ? REG_I : 0); break;
+        case OP_LD_R:
+            r = reg_range(0, in->x); break;
+        case OP_LD_RV:
+            w = reg_range(0, in->x); break;
+        case OP_SAVE_RANGE:
+            r = reg_range(in->x, in->y) | REG_I; break;
+        case OP_LOAD_RANGE:
+            r = REG_I; w = reg_range(in->x, in->y); break;
+    }
+    *reads = r;
+    *writes = w;
+}
+
+// whether an instruction reads or writes memory from I on (CHIP8_DEBUG_*), and how many bytes
+static int op_mem(const Chip8 *chip, const Instr *in, int *len){
+    switch (in->op){
+        case OP_LD_B:       *len = 3; return CHIP8_DEBUG_WRITE;
+        case OP_LD_MEM:     *len = in->x + 1; return CHIP8_DEBUG_WRITE;
+        case OP_LD_REG:     *len = in->x + 1; return CHIP8_DEBUG_READ;
+        case OP_SAVE_RANGE: *len = abs(in->x - in->y) + 1; return CHIP8_DEBUG_WRITE;
+        case OP_LOAD_RANGE: *len = abs(in->x - in->y) + 1; return CHIP8_DEBUG_READ;
+        case OP_DRW:
+            *len = in->n == 0 && chip->variant != CHIP8_VARIANT_CHIP8 ? 32 : in->n;
+            if (chip->variant == CHIP8_VARIANT_XOCHIP)
+                *len *= (chip->planes & 1) + (chip->planes >> 1 & 1);
+            return CHIP8_DEBUG_READ;
+    }
+    *len = 0;
+    return 0;
+}
+
+// point p concerns the instruction at pc at all. for memory, whether it does this time is up to I
+static int point_marks(const Chip8 *chip, const DebugPoint *p, uint16_t pc, const Instr *in){
+    uint32_t reads, writes;
+    int len;
+    switch (p->kind){
+        case POINT_BREAK:
+            return p->lo == pc;
+        case POINT_REG:
+            op_regs(chip, in, &reads, &writes);
+            return ((p->rw & CHIP8_DEBUG_READ) && (reads & p->regs)) ||
+                   ((p->rw & CHIP8_DEBUG_WRITE) && (writes & p->regs));
+        case POINT_MEM:
+            return (op_mem(chip, in, &len) & p->rw) != 0;
+    }
+    return 0;
+}
+
+static int point_hit(const Chip8 *chip, const DebugPoint *p, uint16_t pc, const Instr *in){
+    int len;
+    if (!point_marks(chip, p, pc, in))
+        return 0;
+    if (p->kind == POINT_MEM){
+        op_mem(chip, in, &len);
+        int k;
+        for (k = 0; k < len; k++){
+            uint16_t addr = (chip->I + k) & chip->mask;
+            if (addr >= p->lo && addr <= p->hi)
+                break;
+        }
+        if (k == len)
+            return 0;
+    }
+    return !p->cond_set || expr_eval(chip, &p->cond) != 0;
+}
+
+static void debug_mark(Chip8 *chip, uint16_t pc){
+    pc &= chip->mask;
+    Instr *in = code_at(chip, pc);
+    if (in->op == OP_DECODE || in->op == OP_BREAK)
+        return;
+    int i;
+    for (i = 0; i < DEBUG_POINTS; i++)
+        if (point_marks(chip, &chip->debug->points[i], pc, in))
+            break;
+    if (i == DEBUG_POINTS)
+        return;
+    code_own(chip, PAGE_M(pc, chip->mask), chip->mask);
+    in = code_at(chip, pc);
+    chip->debug->orig[pc] = in->op;
+    in->op = OP_BREAK;
+}
+
+// only pages of our own hold marks, unmarking never copies one
+static void debug_unmark(Chip8 *chip, const Debug *d){
+    for (uint32_t pc = 0; pc <= chip->mask; pc++){
+        Instr *in = code_at(chip, pc);
+        if (in->op == OP_BREAK)
+            in->op = d->orig[pc];
+    }
+}
+
+/* mark all of memory over again for the points there are now */
+static void debug_remark(Chip8 *chip){
+    debug_unmark(chip, chip->debug);
+    for (uint32_t pc = 0; pc <= chip->mask; pc++)
+        debug_mark(chip, pc);
+}
+
+/*
+    run_core() at a mark. NULL to stop before the instruction, else the instruction to run
+    in its place: the same one decoded as what it was before it was marked.
+*/
+static __attribute__((noinline, cold)) const Instr *debug_hit(Chip8 *chip, uint16_t pc, const Instr *in){
+    Debug *d = chip->debug;
+    pc &= chip->mask;
+    d->run = *in;
+    d->run.op = d->orig[pc];
+    if (d->stop != 0)
+        return NULL;
+    if (d->pass == pc){
+        d->pass = -1;
+        return &d->run;
+    }
+    d->pass = -1;
+    for (int i = 0; i < DEBUG_POINTS; i++){
+        DebugPoint *p = &d->points[i];
+        if (p->kind != POINT_NONE && point_hit(chip, p, pc, &d->run)){
+            p->hits++;
+            d->stop = i + 1;
+            d->pass = pc;
+            return NULL;
+        }
+    }
+    return &d->run;
+}
+
+/* start debugging chip. there are no points yet, it runs as before until some are added */
+int chip8_debug_attach(Chip8 *chip){
+    if (chip->debug != NULL)
+        return 1;
+    if (chip->jit != NULL || chip->code_map != NULL){
+        fprintf(stderr, "%s", "Error: the debugger only works with the interpreter\n");
+        return 0;
+    }
+    if ((chip->debug = (Debug*)calloc(1, sizeof(Debug))) == NULL){
+        fprintf(stderr, "%s", "Error: allocating the debugger\n");
+        return 0;
+    }
+    chip->debug->pass = -1;
+    if (chip->fuse)
+        fuse_all(chip);         // held off, see fuse_at()
+    return 1;
+}
+
+void chip8_debug_detach(Chip8 *chip){
+    Debug *d = chip->debug;
+    if (d == NULL)
+        return;
+    debug_unmark(chip, d);
+    chip->debug = NULL;
+    free(d);
+    if (chip->fuse)
+        fuse_all(chip);
+}
+
+static int point_new(Chip8 *chip, const char *cond){
+    if (!chip8_debug_attach(chip))
+        return 0;
+    for (int i = 0; i < DEBUG_POINTS; i++){
+        DebugPoint *p = &chip->debug->points[i];
+        if (p->kind != POINT_NONE)
+            continue;
+        memset(p, 0, sizeof(*p));
+        if (cond != NULL && !(p->cond_set = expr_compile(cond, &p->cond)))
+            return 0;
+        return i + 1;
+    }
+    fprintf(stderr, "Error: there can only be %d breakpoints and watchpoints\n", DEBUG_POINTS);
+    return 0;
+}
+
+/* stop before the instruction at pc, whenever cond (NULL: always) holds. the new point's id, 0 if it can't */
+int chip8_debug_break(Chip8 *chip, uint16_t pc, const char *cond){
+    int id = point_new(chip, cond);
+    if (id == 0)
+        return 0;
+    DebugPoint *p = &chip->debug->points[id - 1];
+    p->kind = POINT_BREAK;
+    p->lo = pc & chip->mask;
+    snprintf(p->text, sizeof(p->text), "break 0x%03x%s%s", p->lo, cond ? " if " : "", cond ? cond : "");
+    debug_remark(chip);
+    return id;
+}
+
+/*
+    stop before any instruction that reads (CHIP8_DEBUG_READ) and/or writes (CHIP8_DEBUG_WRITE)
+    what: a register (v0-vf, i), an address or a range of them ("0x300-0x30f"), while cond holds
+*/
+int chip8_debug_watch(Chip8 *chip, const char *what, int rw, const char *cond){
+    uint32_t regs = 0;
+    unsigned long lo = 0, hi = 0;
+    char *end;
+    if (tolower((unsigned char)what[0]) == 'v' && isxdigit((unsigned char)what[1]) && what[2] == '\0')
+        regs = 1u << strtol(what + 1, NULL, 16);
+    else if (tolower((unsigned char)what[0]) == 'i' && what[1] == '\0')
+        regs = REG_I;
+    else {
+        lo = hi = strtoul(what, &end, 0);
+        if (end != what && *end == '-')
+            hi = strtoul(end + 1, &end, 0);
+        if (end == what || *end != '\0' || lo > hi || hi > chip->mask){
+            fprintf(stderr, "Error: can't watch %s, it's a register (v0-vf, i), an address or a range of them\n", what);
+            return 0;
+        }
+    }
+    if ((rw & (CHIP8_DEBUG_READ | CHIP8_DEBUG_WRITE)) == 0)
+        return 0;
+    int id = point_new(chip, cond);
+    if (id == 0)
+        return 0;
+    DebugPoint *p = &chip->debug->points[id - 1];
+    p->kind = regs ? POINT_REG : POINT_MEM;
+    p->rw = rw;
+    p->regs = regs;
+    p->lo = lo;
+    p->hi = hi;
+    snprintf(p->text, sizeof(p->text), "watch %s%s %s%s%s", rw & CHIP8_DEBUG_READ ? "r" : "",
+             rw & CHIP8_DEBUG_WRITE ? "w" : "", what, cond ? " if " : "", cond ? cond : "");
+    debug_remark(chip);
+    return id;
+}
+
+int chip8_debug_delete(Chip8 *chip, int id){
+    if (chip->debug == NULL || id < 1 || id > DEBUG_POINTS || chip->debug->points[id - 1].kind == POINT_NONE)
+        return 0;
+    chip->debug->points[id - 1].kind = POINT_NONE;
+    debug_remark(chip);
+    return 1;
+}
+
+/* the point the last chip8_run() stopped at, 0 if it didn't. until this is asked, chip8_run() stays stopped */
+int chip8_debug_stopped(Chip8 *chip){
+    if (chip->debug == NULL)
+        return 0;
+    int id = chip->debug->stop;
+    chip->debug->stop = 0;
+    return id;
+}
+
+int chip8_debug_eval(const Chip8 *chip, const char *expr, long *value){
+    Expr e;
+    if (!expr_compile(expr, &e))
+        return 0;
+    *value = (long)expr_eval(chip, &e);
+    return 1;
+}
+
+/*
+    random numbers for Cxkk. every Chip8 has its own xorshift64* state, set up by chip8_seed(),
+    so parallel runs share no lock and any run can be repeated bit for bit from its seed.
+*/
+void chip8_seed(Chip8 *chip, uint64_t seed){
+    // splitmix64 first, so seeds 0, 1, 2, ... give unrelated streams. xorshift can't start at 0
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    chip->rng = z != 0 ? z : 1;
+}
+
+static inline uint8_t chip8_random(Chip8 *chip){
+    uint64_t x = chip->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip->rng = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 56;   // top byte, the best mixed one
+}
+
+/*
+    SUPER-CHIP and XO-CHIP screens. in lores a plane is HEIGHT rows of one word, like CHIP-8's;
+    in hires HI_HEIGHT rows of two, row y in words 2y and 2y + 1. either way a row goes
+    through here as the top bits of a 128 bit int, x = 0 being the top bit.
+*/
+typedef unsigned __int128 Row;
+
+static inline Row row_get(const uint64_t *plane, int y, int hires){
+    return hires ? (Row)plane[2 * y] << 64 | plane[2 * y + 1] : (Row)plane[y] << 64;
+}
+
+static inline void row_put(uint64_t *plane, int y, int hires, Row bits){
+    if (hires){
+        plane[2 * y] = bits >> 64;
+        plane[2 * y + 1] = (uint64_t)bits;
+    } else {
+        plane[y] = bits >> 64;
+    }
+}
+
+// a taken skip in XO-CHIP steps over all four bytes of an F000 nnnn
+static inline int xo_skip(const Chip8 *chip, uint16_t mask){
+    uint16_t next = chip->pc + 2;
+    return mem_read_m(chip, next, mask) == 0xF0 && mem_read_m(chip, next + 1, mask) == 0x00 ? 6 : 4;
+}
+
+// 00E0 clears only the planes selected with Fn01, always plane 0 outside XO-CHIP
+static void screen_clear(Chip8 *chip){
+    for (int p = 0; p < PLANES; p++)
+        if (chip->planes >> p & 1)
+            memset(chip->ext->screen[p], 0, sizeof(chip->ext->screen[p]));
+}
+
+// 00FE/00FF. switching mode clears every plane
+static void screen_mode(Chip8 *chip, int hires){
+    chip->hires = hires;
+    memset(chip->ext->screen, 0, sizeof(chip->ext->screen));
+    chip->screen_dirty = 1;
+}
+
+// move the selected planes dy rows down (up if negative) and dx pixels right (left)
+static void screen_scroll(Chip8 *chip, int dy, int dx){
+    int h = chip->hires ? HI_HEIGHT : HEIGHT;
+    Row width = chip->hires ? ~(Row)0 : ~(Row)0 << 64;
+    for (int p = 0; p < PLANES; p++){
+        if (!(chip->planes >> p & 1))
+            continue;
+        uint64_t *plane = chip->ext->screen[p];
+        for (int i = 0; i < h; i++){
+            int y = dy > 0 ? h - 1 - i : i;     // against the direction of the move
+            int from = y - dy;
+            Row bits = from >= 0 && from < h ? row_get(plane, from, chip->hires) : 0;
+            bits = dx > 0 ? bits >> dx : bits << -dx;
+            row_put(plane, y, chip->hires, bits & width);
+        }
+    }
+    chip->screen_dirty = 1;
+}
+
+/*
+    Dxyn on SUPER-CHIP and XO-CHIP: 8 pixels wide and n rows, or 16x16 for n = 0, in whichever
+    mode the screen is in, into every selected plane (XO-CHIP takes the sprite for plane 1
+    right after the one for plane 0). the position wraps, the sprite itself clips at the
+    edges, or wraps too with `wrap`. returns the collisions, and the rows drawn in *rows.
+*/
+static inline __attribute__((always_inline))
+uint64_t draw_ext(Chip8 *chip, const Instr *in, uint16_t mask, int wrap, int *rows){
+    int hires = chip->hires, w = hires ? HI_WIDTH : WIDTH, h = hires ? HI_HEIGHT : HEIGHT;
+    int wide = in->n == 0, height = wide ? 16 : in->n;
+    unsigned x = chip->v[in->x] & (w - 1), y = chip->v[in->y] & (h - 1);
+    Row width = hires ? ~(Row)0 : ~(Row)0 << 64, hit = 0;
+    uint16_t addr = chip->I;
+    *rows = wrap || height <= h - (int)y ? height : h - (int)y;
+    for (int p = 0; p < PLANES; p++){
+        if (!(chip->planes >> p & 1))
+            continue;
+        uint64_t *plane = chip->ext->screen[p];
+        for (int r = 0; r < *rows; r++, addr += 1 + wide){
+            Row sprite = (Row)mem_read_m(chip, addr, mask) << 120;
+            if (wide)
+                sprite |= (Row)mem_read_m(chip, addr + 1, mask) << 112;
+            Row bits = sprite >> x;
+            if (wrap && x != 0)
+                bits |= sprite << (w - x);
+            bits &= width;
+            int yy = (y + r) & (h - 1);
+            Row old = row_get(plane, yy, hires);
+            hit |= old & bits;
+            row_put(plane, yy, hires, old ^ bits);
+        }
+        addr += (height - *rows) * (1 + wide);  // the clipped rows still take up room
+    }
+    chip->screen_dirty = 1;
+    return hit != 0;
+}
+
+#if defined(__GNUC__) && !defined(CHIP8_NO_THREADED)
+#define THREADED_DISPATCH 1
+#endif
+
+// run_core() for CHIP-8, see core.inc
+#define CORE_NAME run_core
+#define CORE_SCHIP 0
+#define CORE_XO 0
+#include "core.inc"
+
+#define CORE_NAME run_core_schip
+#define CORE_SCHIP 1
+#define CORE_XO 0
+#include "core.inc"
+
+#define CORE_NAME run_core_xo
+#define CORE_SCHIP 1
+#define CORE_XO 1
+#include "core.inc"
+
+// little endian fields of the snapshot and replay formats
+static uint8_t *put_le(uint8_t *p, uint64_t val, int bytes){
+    for (int i = 0; i < bytes; i++)
+        *p++ = val >> (8 * i);
+    return p;
+}
+
+static uint64_t get_le(const uint8_t **p, int bytes){
+    uint64_t val = 0;
+    for (int i = 0; i < bytes; i++)
+        val |= (uint64_t)*(*p)++ << (8 * i);
+    return val;
+}
+
+/*
+    keyboard input. chip->keys is the state of the 16 keys and only changes between
+    instructions, through chip8_key(). a session can be recorded as a replay: every event
+    with the cycle it happened on, as a small header and then a varint cycle delta and a
+    key byte (key | 0x80 when down) per event:
+
+        "C8IN" version:u16 seed:u64 ipf:u32 { delta:varint key:u8 }...
+
+    played back, the events go in at exactly the same cycles (the timed run loop stops on
+    chip->next_input just like it stops on a timer tick), with the seed and speed the
+    session had, so it ends in exactly the same state however fast it is run.
+*/
+#define INPUT_MAGIC     "C8IN"
+#define INPUT_VERSION   1
+#define NO_INPUT        UINT64_MAX
+
+typedef struct KeyEvent {
+    uint64_t        cycle;
+    uint8_t         key;            // key | 0x80 when down
+} KeyEvent;
+
+struct Chip8Input {
+    KeyEvent        *events;        // playback: the whole replay
+    size_t          count, next;
+    FILE            *log;           // recording: where events go, NULL when playing back
+    uint64_t        last;           // cycle of the last event written
+};
+
+static int input_put_varint(FILE *f, uint64_t val){
+    while (val >= 0x80){
+        fputc((val & 0x7F) | 0x80, f);
+        val >>= 7;
+    }
+    return fputc(val, f) != EOF;
+}
+
+static int input_get_varint(FILE *f, uint64_t *val){
+    *val = 0;
+    for (int shift = 0; shift < 64; shift += 7){
+        int c = fgetc(f);
+        if (c == EOF)
+            return 0;
+        *val |= (uint64_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+/* press (down = 1) or release key k, and log it if the session is being recorded */
+void chip8_key(Chip8 *chip, int key, int down){
+    uint16_t bit = 1 << (key & 0xF);
+    if (!!(chip->keys & bit) == !!down)
+        return;
+    chip->keys ^= bit;
+    Chip8Input *in = chip->input;
+    if (in != NULL && in->log != NULL){
+        input_put_varint(in->log, chip->cycles - in->last);
+        fputc((key & 0xF) | (down ? 0x80 : 0), in->log);
+        in->last = chip->cycles;
+    }
+}
+
+/* apply every replayed event that is due by now */
+static void input_apply(Chip8 *chip){
+    Chip8Input *in = chip->input;
+    while (in->next < in->count && in->events[in->next].cycle <= chip->cycles){
+        uint8_t k = in->events[in->next++].key;
+        chip->keys = k & 0x80 ? chip->keys | 1 << (k & 0xF) : chip->keys & ~(1 << (k & 0xF));
+    }
+    chip->next_input = in->next < in->count ? in->events[in->next].cycle : NO_INPUT;
+}
+
+/* read a replay. the seed and ips it was recorded with come back through seed and ips */
+Chip8Input *chip8_input_open(const char *path, uint64_t *seed, uint32_t *ips){
+    FILE *f = fopen(path, "rb");
+    if (f == NULL){
+        fprintf(stderr, "Error: could not open replay %s\n", path);
+        return NULL;
+    }
+    uint8_t head[4 + 2 + 8 + 4];
+    const uint8_t *p = head + 4;
+    Chip8Input *in = NULL;
+    if (fread(head, 1, sizeof(head), f) != sizeof(head) || memcmp(head, INPUT_MAGIC, 4) != 0
+        || get_le(&p, 2) != INPUT_VERSION){
+        fprintf(stderr, "Error: %s is not a replay this version can read\n", path);
+    } else if ((in = (Chip8Input*)calloc(1, sizeof(Chip8Input))) != NULL){
+        *seed = get_le(&p, 8);
+        *ips = get_le(&p, 4) * TIMER_HZ;
+        size_t cap = 0;
+        uint64_t delta, cycle = 0;
+        int key;
+        while (input_get_varint(f, &delta) && (key = fgetc(f)) != EOF){
+            if (in->count == cap){
+                cap = cap ? cap * 2 : 256;
+                KeyEvent *ev = (KeyEvent*)realloc(in->events, cap * sizeof(KeyEvent));
+                if (ev == NULL)
+                    break;
+                in->events = ev;
+            }
+            cycle += delta;
+            in->events[in->count].cycle = cycle;
+            in->events[in->count++].key = key;
+        }
+    }
+    fclose(f);
+    return in;
+}
+
+/* start recording a session of chip, which was seeded with seed */
+Chip8Input *chip8_input_record(const char *path, uint64_t seed, const Chip8 *chip){
+    uint8_t head[4 + 2 + 8 + 4], *p = head + 4;
+    Chip8Input *in = (Chip8Input*)calloc(1, sizeof(Chip8Input));
+    if (in == NULL)
+        return NULL;
+    in->log = fopen(path, "wb");
+    if (in->log == NULL){
+        fprintf(stderr, "Error: could not create replay %s\n", path);
+        free(in);
+        return NULL;
+    }
+    memcpy(head, INPUT_MAGIC, 4);
+    p = put_le(p, INPUT_VERSION, 2);
+    p = put_le(p, seed, 8);
+    put_le(p, chip->ipf, 4);
+    fwrite(head, 1, sizeof(head), in->log);
+    return in;
+}
+
+/* line a replay up with chip's clock, after it was attached or the clock was set back */
+static void input_seek(Chip8 *chip){
+    Chip8Input *in = chip->input;
+    chip->next_input = NO_INPUT;
+    if (in == NULL)
+        return;
+    // events from before now are already in chip->keys, the ones due right now are harmless
+    in->last = chip->cycles;
+    in->next = 0;
+    while (in->next < in->count && in->events[in->next].cycle < chip->cycles)
+        in->next++;
+    input_apply(chip);
+}
+
+/* feed in to chip (or record chip into it) from its current cycle on */
+void chip8_input_attach(Chip8 *chip, Chip8Input *in){
+    chip->input = in;
+    input_seek(chip);
+}
+
+void chip8_input_close(Chip8Input *in){
+    if (in == NULL)
+        return;
+    if (in->log != NULL)
+        fclose(in->log);
+    free(in->events);
+    free(in);
+}
+
+/*
+    timers. they count down at 60 Hz of emulated time, i.e. once every chip->ipf instructions,
+    never off the host clock, so a run of n cycles ends in the same state however fast or slow
+    the host was. each engine runs in slices that stop on a tick boundary (or a replayed
+    key event) and lets chip8_run_timed() do the bookkeeping in between.
+*/
+void chip8_set_ips(Chip8 *chip, uint32_t ips){
+    chip->ipf = ips / TIMER_HZ > 0 ? ips / TIMER_HZ : 1;
+    chip->next_tick = chip->cycles + chip->ipf;
+}
+
+static inline void timers_tick(Chip8 *chip){
+    if (chip->delayTimer > 0) chip->delayTimer--;
+    if (chip->soundTimer > 0) chip->soundTimer--;
+    chip->next_tick += chip->ipf;
+}
+
+// instructions left before the timers tick
+static inline uint64_t until_tick(const Chip8 *chip){
+    return chip->next_tick - chip->cycles;
+}
+
+// instructions left before the timers tick or a key event is due, whichever is first
+static inline uint64_t until_event(const Chip8 *chip){
+    uint64_t next = chip->next_tick < chip->next_input ? chip->next_tick : chip->next_input;
+    return next - chip->cycles;
+}
+
+// advance the emulated clock by n instructions that some engine has already run
+static inline void clock_advance(Chip8 *chip, uint64_t n){
+    chip->cycles += n;
+    if (chip->cycles == chip->next_tick)
+        timers_tick(chip);
+    if (chip->cycles >= chip->next_input)
+        input_apply(chip);
+}
+
+// does an idle loop with this head keep spinning when it reads val?
+static inline int idle_spins(const Instr *head, uint8_t val){
+    return head->y ? val != (head->nnn & 0xFF) : val == (head->nnn & 0xFF);
+}
+
+// clock_advance() by a whole number of ticks at once
+static inline void clock_skip(Chip8 *chip, uint64_t ticks){
+    chip->delayTimer = ticks < chip->delayTimer ? chip->delayTimer - ticks : 0;
+    chip->soundTimer = ticks < chip->soundTimer ? chip->soundTimer - ticks : 0;
+    chip->cycles += ticks * chip->ipf;
+    chip->next_tick += ticks * chip->ipf;
+    if (chip->cycles >= chip->next_input)
+        input_apply(chip);
+}
+
+/*
+    called on a tick boundary with `budget` instructions to go. if pc is inside an idle loop
+    that spins through the whole coming tick, jump over every tick it keeps spinning for in
+    one go and return the instructions that stands for (a whole number of ticks), else 0.
+    the loops it knows:
+    - Fx0A with no key down spins on itself, only the timers move. it spins until the
+      next key event, which is never before chip->next_input.
+    - delay timer waits (see decode_at()). while one spins the loop only ever sets Vx to the
+      current delay timer, and with at least 3 instructions per tick every tick runs the
+      Fx07 at least once, so the state after T ticks is known without running them: Vx
+      holds the timer as it was during the last one and pc has moved on by T * ipf
+      instructions around the 3 instruction loop.
+*/
+static uint64_t idle_skip(Chip8 *chip, uint64_t budget){
+    if (budget > chip->next_input - chip->cycles)
+        budget = chip->next_input - chip->cycles;
+    if (budget < chip->ipf || until_tick(chip) != chip->ipf || chip->trace != NULL)
+        return 0;
+    uint16_t pc = chip->pc & chip->mask;
+    if (code_at(chip, pc)->op == OP_LD_K && chip->keys == 0 && chip->pc == pc){
+        uint64_t ticks = budget / chip->ipf;
+        clock_skip(chip, ticks);
+        return ticks * chip->ipf;
+    }
+    if (chip->ipf < 3)
+        return 0;
+    int phase;
+    for (phase = 0; phase < 3; phase++)
+        if (op_base(code_at(chip, pc - 2 * phase)->op) == OP_WAIT_DT)
+            break;
+    if (phase == 3 || (chip->pc & 1))
+        return 0;
+    uint16_t head = (pc - 2 * phase) & chip->mask;
+    const Instr *in = code_at(chip, head);
+    // the debugger may have to stop in there (a marked head isn't OP_WAIT_DT to begin with)
+    if (chip->debug != NULL && (code_at(chip, head + 2)->op == OP_BREAK || code_at(chip, head + 4)->op == OP_BREAK))
+        return 0;
+    uint8_t dt = chip->delayTimer, kk = in->nnn & 0xFF;
+    // sitting on the SE/SNE, the value it tests is still from the previous tick
+    if (!idle_spins(in, dt) || (phase == 1 && !idle_spins(in, chip->v[in->x])))
+        return 0;
+
+    // ticks it keeps spinning for: until the timer gets to kk (SE), or moves off kk (SNE)
+    uint64_t ticks = budget / chip->ipf;
+    if (in->y && dt > kk && (uint64_t)(dt - kk) < ticks)
+        ticks = dt - kk;
+    if (!in->y && dt != 0 && ticks > 1)
+        ticks = 1;
+
+    uint64_t n = ticks * chip->ipf;
+    chip->v[in->x] = ticks - 1 < dt ? dt - (ticks - 1) : 0;
+    chip->pc = head + 2 * ((phase + n) % 3);
+    clock_skip(chip, ticks);
+    return n;
+}
+
+static inline __attribute__((always_inline))
+uint64_t chip8_run_timed(Chip8 *chip, uint64_t cycles, uint64_t (*core)(Chip8 *, uint64_t)){
+    uint64_t done = 0;
+    while (done < cycles){
+        uint64_t n = idle_skip(chip, cycles - done);
+        prof_skip(chip, n);
+        done += n;
+        n = cycles - done;
+        if (n == 0) break;
+        if (n > until_event(chip)) n = until_event(chip);
+        n = core(chip, n);
+        if (n == 0) break;
+        done += n;
+        clock_advance(chip, n);
+        if (chip->trace != NULL && chip->trace->grams != NULL && chip->grams->total >= chip->grams->warmup)
+            fuse_warm(chip);
+    }
+    return done;
+}
+
+uint64_t chip8_run(Chip8 *chip, uint64_t cycles){
+    switch (chip->variant){
+        case CHIP8_VARIANT_SCHIP:  return chip8_run_timed(chip, cycles, run_core_schip);
+        case CHIP8_VARIANT_XOCHIP: return chip8_run_timed(chip, cycles, run_core_xo);
+    }
+    return chip8_run_timed(chip, cycles, run_core);
+}
+
+/* run the rest of the current frame, i.e. up to and including the next timer tick */
+uint64_t chip8_run_until_frame(Chip8 *chip){
+    return chip8_run(chip, until_tick(chip));
+}
+
+/*
+    read-only views for whoever embeds the library. the screen is the live array, one
+    uint64_t per row (two in hires); everything else is copied out.
+*/
+const uint64_t *chip8_screen(const Chip8 *chip){
+    return screen_plane(chip, 0);
+}
+
+const uint64_t *chip8_screen_plane(const Chip8 *chip, int plane){
+    return screen_plane(chip, plane);
+}
+
+void chip8_screen_size(const Chip8 *chip, int *width, int *height){
+    *width = chip->hires ? HI_WIDTH : WIDTH;
+    *height = chip->hires ? HI_HEIGHT : HEIGHT;
+}
+
+int chip8_screen_dirty(const Chip8 *chip){
+    return chip->screen_dirty;
+}
+
+void chip8_screen_seen(Chip8 *chip){
+    chip->screen_dirty = 0;
+}
+
+uint8_t chip8_peek(const Chip8 *chip, uint16_t addr){
+    return mem_read(chip, addr);
+}
+
+void chip8_regs(const Chip8 *chip, Chip8Regs *regs){
+    regs->pc = chip->pc;
+    regs->I = chip->I;
+    regs->sp = chip->sp;
+    regs->opcode = chip8_peek(chip, chip->pc) << 8 | chip8_peek(chip, chip->pc + 1);
+    memcpy(regs->stack, chip->stack, sizeof(regs->stack));
+    memcpy(regs->v, chip->v, sizeof(regs->v));
+    regs->delay = chip->delayTimer;
+    regs->sound = chip->soundTimer;
+    regs->keys = chip->keys;
+    regs->cycles = chip->cycles;
+}
+
+/* single step, same handlers as chip8_run(). chip->opcode is left holding what it ran */
+void interpreter(Chip8 *chip){
+    getop(chip);
+    chip8_run(chip, 1);
+}
+
+/*
+    disassembler, only used when something has to be shown to a person (trace dumps, the
+    interactive loop). writes the mnemonic for opcode into buf and returns buf.
+*/
+char *chip8_disasm(uint16_t opcode, int variant, char *buf, size_t size){
+    unsigned x = (opcode & 0x0F00) >> 8, y = (opcode & 0x00F0) >> 4;
+    unsigned n = opcode & 0xF, kk = opcode & 0xFF, nnn = opcode & 0xFFF;
+    // what SUPER-CHIP and XO-CHIP add or change, as decode_for() has it
+    switch (decode_for(opcode, variant).op){
+        case OP_SCD:        snprintf(buf, size, "SCD %u", n); return buf;
+        case OP_SCU:        snprintf(buf, size, "SCU %u", n); return buf;
+        case OP_SCR:        snprintf(buf, size, "SCR"); return buf;
+        case OP_SCL:        snprintf(buf, size, "SCL"); return buf;
+        case OP_EXIT:       snprintf(buf, size, "EXIT"); return buf;
+        case OP_LOW:        snprintf(buf, size, "LOW"); return buf;
+        case OP_HIGH:       snprintf(buf, size, "HIGH"); return buf;
+        case OP_LD_HF:      snprintf(buf, size, "LD HF, V%X", x); return buf;
+        case OP_LD_R:       snprintf(buf, size, "LD R, V%X", x); return buf;
+        case OP_LD_RV:      snprintf(buf, size, "LD V%X, R", x); return buf;
+        case OP_SAVE_RANGE: snprintf(buf, size, "LD [I], V%X-V%X", x, y); return buf;
+        case OP_LOAD_RANGE: snprintf(buf, size, "LD V%X-V%X, [I]", x, y); return buf;
+        case OP_LD_I_LONG:  snprintf(buf, size, "LD I, LONG"); return buf;   // the address is the next word
+        case OP_PLANE:      snprintf(buf, size, "PLANE %u", x); return buf;
+        case OP_AUDIO:      snprintf(buf, size, "AUDIO"); return buf;
+        case OP_PITCH:      snprintf(buf, size, "PITCH V%X", x); return buf;
+    }
+    if ((opcode & 0xF000) == 0xB000 && variant == CHIP8_VARIANT_SCHIP){
+        snprintf(buf, size, "JP V%X, 0x%03x", x, nnn);    // xnn + Vx
+        return buf;
+    }
+    switch (opcode & 0xF000){
+        case 0x0000:
+            if (opcode == 0x00E0)      snprintf(buf, size, "CLS");
+            else if (opcode == 0x00EE) snprintf(buf, size, "RET");
+            else                       snprintf(buf, size, "SYS 0x%03x", nnn);
+            break;
+        case 0x1000: snprintf(buf, size, "JP 0x%03x", nnn); break;
+        case 0x2000: snprintf(buf, size, "CALL 0x%03x", nnn); break;
+        case 0x3000: snprintf(buf, size, "SE V%X, 0x%02x", x, kk); break;
+        case 0x4000: snprintf(buf, size, "SNE V%X, 0x%02x", x, kk); break;
+        case 0x5000: snprintf(buf, size, "SE V%X, V%X", x, y); break;
+        case 0x6000: snprintf(buf, size, "LD V%X, 0x%02x", x, kk); break;
+        case 0x7000: snprintf(buf, size, "ADD V%X, 0x%02x", x, kk); break;
+        case 0x8000: {
+            static const char *alu[16] = { "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                                           NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL };
+            if (alu[n] != NULL) snprintf(buf, size, "%s V%X, V%X", alu[n], x, y);
+            else                snprintf(buf, size, "??? 0x%04x", opcode);
+            break;
+        }
+        case 0x9000: snprintf(buf, size, "SNE V%X, V%X", x, y); break;
+        case 0xA000: snprintf(buf, size, "LD I, 0x%03x", nnn); break;
+        case 0xB000: snprintf(buf, size, "JP V0, 0x%03x", nnn); break;
+        case 0xC000: snprintf(buf, size, "RND V%X, 0x%02x", x, kk); break;
+        case 0xD000: snprintf(buf, size, "DRW V%X, V%X, %u", x, y, n); break;
+        case 0xE000:
+            if (kk == 0x9E)      snprintf(buf, size, "SKP V%X", x);
+            else if (kk == 0xA1) snprintf(buf, size, "SKNP V%X", x);
+            else                 snprintf(buf, size, "??? 0x%04x", opcode);
+            break;
+        case 0xF000:
+            switch (kk){
+                case 0x07: snprintf(buf, size, "LD V%X, DT", x); break;
+                case 0x0A: snprintf(buf, size, "LD V%X, K", x); break;
+                case 0x15: snprintf(buf, size, "LD DT, V%X", x); break;
+                case 0x18: snprintf(buf, size, "LD ST, V%X", x); break;
+                case 0x1E: snprintf(buf, size, "ADD I, V%X", x); break;
+                case 0x29: snprintf(buf, size, "LD F, V%X", x); break;
+                case 0x33: snprintf(buf, size, "LD B, V%X", x); break;
+                case 0x55: snprintf(buf, size, "LD [I], V%X", x); break;
+                case 0x65: snprintf(buf, size, "LD V%X, [I]", x); break;
+                default:   snprintf(buf, size, "??? 0x%04x", opcode); break;
+            }
+            break;
+    }
+    return buf;
+}
+
+int chip8_trace_attach(Chip8 *chip){
+    if (chip->trace != NULL)
+        return 0;
+    chip->trace = (Trace*)calloc(1, sizeof(Trace));
+    return chip->trace != NULL;
+}
+
+void chip8_trace_detach(Chip8 *chip){
+    free(chip->trace);
+    chip->trace = NULL;
+}
+
+/* print the last n records, oldest first */
+void chip8_trace_dump(FILE *out, Chip8 *chip, uint64_t n){
+    Trace *t = chip->trace;
+    char text[32];
+    if (t == NULL)
+        return;
+    if (n > t->count) n = t->count;
+    if (n > TRACE_SIZE) n = TRACE_SIZE;
+    for (uint64_t i = t->count - n; i < t->count; i++){
+        const TraceRec *r = &t->rec[i & (TRACE_SIZE - 1)];
+        fprintf(out, "%10llu  %03x  %04x  %-16s I=%03x", (unsigned long long)i, r->pc, r->opcode,
+                chip8_disasm(r->opcode, chip->variant, text, sizeof(text)), r->I);
+        if (r->reg != TRACE_NO_REG)
+            fprintf(out, "  V%X=%02x", r->reg, r->val);
+        fprintf(out, "\n");
+    }
+}
+
+/*
+    dynamic recompiler for x86-64 (System V). instead of single basic blocks it compiles a small
+    region: every instruction reachable from the entry pc through straight-line code, skips and
+    1nnn jumps, up to JIT_MAX_REGION instructions. inside the region, skips and jumps are native
+    branches, so tight loops never leave generated code. anything it can't compile (calls,
+    returns, Bnnn, draws, memory ops, ...) becomes an exit that stores pc and returns, and
+    chip8_run_jit() runs that one instruction through the interpreter.
+
+    a region is called as  uint32_t fn(Chip8 *chip, uint32_t budget)  and returns the unused
+    budget. every compiled instruction costs one unit of budget, so cycle counts are exact.
+    V registers stay in the Chip8 struct and are used as memory operands.
+*/
+#if defined(__x86_64__) && !defined(_WIN32) && !defined(CHIP8_NO_JIT)
+#define HAVE_JIT 1
+#endif
+
+#define JIT_CODE_SIZE   (1 << 20)
+#define JIT_MAX_REGION  64
+#define JIT_MAX_EMIT    (JIT_MAX_REGION * 96 + 64) // worst case bytes for one region
+
+typedef uint32_t (*JitFn)(Chip8 *chip, uint32_t budget);
+
+struct Jit {
+    uint8_t     *code;                  // RWX arena, regions are appended and only freed by flush
+    size_t      used;
+    JitFn       entry[MEMORY_SIZE];     // compiled region starting at each address
+    uint8_t     covered[MEMORY_SIZE];   // byte belongs to an instruction in some region
+    uint32_t    pages[MEMORY_SIZE];     // pages the region starting at each address was compiled from
+    uint8_t     written[MEMORY_SIZE];   // byte was overwritten after being compiled, keep it interpreted
+    uint64_t    flushes;
+};
+_Static_assert(MEM_PAGES <= 32, "jit page masks are 32 bits");
+
+#ifdef HAVE_JIT
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define OFF_V(r)    ((int32_t)(offsetof(Chip8, v) + (r)))
+#define OFF_I       ((int32_t)offsetof(Chip8, I))
+#define OFF_PC      ((int32_t)offsetof(Chip8, pc))
+
+typedef struct Emit {
+    uint8_t     *p;
+} Emit;
+
+static void emit8(Emit *e, uint8_t b) { *e->p++ = b; }
+static void emit16(Emit *e, uint16_t w) { memcpy(e->p, &w, 2); e->p += 2; }
+static void emit32(Emit *e, uint32_t d) { memcpy(e->p, &d, 4); e->p += 4; }
+static void emit_bytes(Emit *e, const char *b, int n) { memcpy(e->p, b, n); e->p += n; }
+
+/* <op> [rdi + disp32] with the ModRM byte already holding reg/opcode-extension and rm = rdi */
+static void emit_mem(Emit *e, const char *op, int n, uint8_t modrm, int32_t disp){
+    emit_bytes(e, op, n);
+    emit8(e, modrm);
+    emit32(e, disp);
+}
+
+#define MODRM(reg) (0x80 | ((reg) << 3) | 7) // mod = disp32, rm = rdi
+enum { EAX, ECX, EDX };
+
+static void movzx_b(Emit *e, int reg, int32_t disp)  { emit_mem(e, "\x0F\xB6", 2, MODRM(reg), disp); }
+static void store_b(Emit *e, int reg, int32_t disp)  { emit_mem(e, "\x88", 1, MODRM(reg), disp); }
+static void store_pc(Emit *e, uint16_t pc)           { emit_mem(e, "\x66\xC7", 2, MODRM(0), OFF_PC); emit16(e, pc); }
+
+/* rel32 branch, returns where to patch the target in */
+static uint8_t *emit_branch(Emit *e, const char *op, int n){
+    emit_bytes(e, op, n);
+    uint8_t *at = e->p;
+    emit32(e, 0);
+    return at;
+}
+
+static void patch(uint8_t *at, uint8_t *target){
+    int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(at, &rel, 4);
+}
+
+static int jit_compilable(const Instr *in){
+    switch(in->op){
+        case OP_JP: case OP_SE_KK: case OP_SNE_KK: case OP_SE_XY: case OP_SNE_XY:
+        case OP_LD_KK: case OP_ADD_KK: case OP_LD_XY: case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_XY: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LD_I: case OP_ADD_I: case OP_LD_F:
+            return 1;
+    }
+    return 0;
+}
+
+/* body of a straight-line op, mirrors the handler in chip8_run() statement for statement */
+static void emit_op(Emit *e, const Instr *in){
+    int32_t vx = OFF_V(in->x), vy = OFF_V(in->y), vf = OFF_V(0xF);
+    uint8_t kk = in->nnn & 0xFF;
+    switch(in->op){
+        case OP_LD_KK:  emit_mem(e, "\xC6", 1, MODRM(0), vx); emit8(e, kk); break;
+        case OP_ADD_KK: emit_mem(e, "\x80", 1, MODRM(0), vx); emit8(e, kk); break;
+        case OP_LD_XY:  movzx_b(e, EAX, vy); store_b(e, EAX, vx); break;
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+            movzx_b(e, EAX, vx);
+            movzx_b(e, ECX, vy);
+            emit8(e, in->op == OP_OR ? 0x08 : in->op == OP_AND ? 0x20 : 0x30);
+            emit8(e, 0xC8);                                     // <op> al, cl
+            store_b(e, EAX, vx);
+            break;
+        case OP_ADD_XY:
+            movzx_b(e, EAX, vx);
+            movzx_b(e, ECX, vy);
+            emit_bytes(e, "\x01\xC8\x89\xC2\xC1\xEA\x08", 7);  // add eax, ecx; mov edx, eax; shr edx, 8
+            store_b(e, EDX, vf);
+            store_b(e, EAX, vx);
+            break;
+        case OP_SUB:
+            movzx_b(e, EAX, vx);
+            movzx_b(e, ECX, vy);
+            emit_bytes(e, "\x38\xC8\x0F\x93\xC2", 5);          // cmp al, cl; setae dl
+            store_b(e, EDX, vf);
+            movzx_b(e, EAX, vx);
+            movzx_b(e, ECX, vy);
+            emit_bytes(e, "\x29\xC8", 2);                      // sub eax, ecx
+            store_b(e, EAX, vx);
+            break;
+        case OP_SUBN:
+            movzx_b(e, EAX, vx);
+            movzx_b(e, ECX, vy);
+            emit_bytes(e, "\x38\xC1\x0F\x93\xC2", 5);          // cmp cl, al; setae dl
+            store_b(e, EDX, vf);
+            movzx_b(e, EAX, vx);
+            movzx_b(e, ECX, vy);
+            emit_bytes(e, "\x29\xC1", 2);                      // sub ecx, eax
+            store_b(e, ECX, vx);
+            break;
+        case OP_SHR:
+            movzx_b(e, EAX, vx);
+            emit_bytes(e, "\x24\x01", 2);                      // and al, 1
+            store_b(e, EAX, vf);
+            movzx_b(e, EAX, vx);
+            emit_bytes(e, "\xD0\xE8", 2);                      // shr al, 1
+            store_b(e, EAX, vx);
+            break;
+        case OP_SHL:
+            movzx_b(e, EAX, vx);
+            emit_bytes(e, "\xC0\xE8\x07", 3);                  // shr al, 7
+            store_b(e, EAX, vf);
+            movzx_b(e, EAX, vx);
+            emit_bytes(e, "\xD0\xE0", 2);                      // shl al, 1
+            store_b(e, EAX, vx);
+            break;
+        case OP_LD_I:
+            emit_mem(e, "\x66\xC7", 2, MODRM(0), OFF_I);
+            emit16(e, in->nnn);
+            break;
+        case OP_ADD_I:
+            movzx_b(e, EAX, vx);
+            emit_mem(e, "\x66\x01", 2, MODRM(EAX), OFF_I);    // add word [I], ax
+            break;
+        case OP_LD_F:
+            movzx_b(e, EAX, vx);
+            emit_bytes(e, "\x8D\x04\x80", 3);                  // lea eax, [rax + rax*4]
+            emit_mem(e, "\x66\x89", 2, MODRM(EAX), OFF_I);    // mov word [I], ax
+            break;
+    }
+}
+
+void jit_flush(struct Jit *jit){
+    jit->used = 0;
+    memset(jit->entry, 0, sizeof(jit->entry));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    memset(jit->pages, 0, sizeof(jit->pages));
+    jit->flushes++;
+}
+
+/*
+    a guest write landed on compiled code. regions only branch inside themselves and leave
+    through the dispatcher, so dropping the entry of every region compiled from the written
+    256-byte page is enough; the rest of the cache stays. their code is left in the arena
+    until the next full flush. the written bytes are remembered and left to the interpreter
+    from now on, so a rom that keeps patching its own code doesn't keep recompiling.
+*/
+static void jit_code_write(Chip8 *chip, uint16_t addr){
+    struct Jit *jit = chip->jit;
+    uint32_t page = 1u << PAGE(addr);
+    jit->written[addr] = 1;
+    for(int a = 0; a < MEMORY_SIZE; a++){
+        if(jit->pages[a] & page){
+            jit->entry[a] = NULL;
+            jit->pages[a] = 0;
+        }
+    }
+    // bytes of dropped regions on other pages stay marked, at worst a later write there drops a bit more
+    memset(jit->covered + PAGE(addr) * MEM_PAGE_SIZE, 0, MEM_PAGE_SIZE);
+}
+
+/* chip has a new rom: nothing compiled from the old one holds, and off CHIP-8 nothing can be */
+static void jit_reload(Chip8 *chip){
+    if (chip->variant != CHIP8_VARIANT_CHIP8){
+        chip8_jit_detach(chip);
+        return;
+    }
+    jit_flush(chip->jit);
+    memset(chip->jit->written, 0, sizeof(chip->jit->written));
+}
+
+/* give chip its own code cache. returns 0 if it can't get executable memory or isn't CHIP-8 */
+int chip8_jit_attach(Chip8 *chip){
+    if (chip->variant != CHIP8_VARIANT_CHIP8)
+        return 0;
+    struct Jit *jit = (struct Jit*)calloc(1, sizeof(struct Jit));
+    if(jit == NULL)
+        return 0;
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if(jit->code == MAP_FAILED){
+        free(jit);
+        return 0;
+    }
+    chip->jit = jit;
+    chip->code_map = jit->covered;
+    chip->code_write = jit_code_write;
+    return 1;
+}
+
+void chip8_jit_detach(Chip8 *chip){
+    if(chip->jit == NULL)
+        return;
+    munmap(chip->jit->code, JIT_CODE_SIZE);
+    free(chip->jit);
+    chip->jit = NULL;
+    chip->code_map = NULL;
+}
+
+static JitFn jit_compile(Chip8 *chip, uint16_t start){
+    struct Jit *jit = chip->jit;
+    uint16_t addrs[JIT_MAX_REGION];
+    Instr    ins[JIT_MAX_REGION];
+    uint8_t  *label[JIT_MAX_REGION];
+    int16_t  index[MEMORY_SIZE];       // address -> slot in the region, or -1
+    int      count = 0;
+    uint32_t pages = 1u << PAGE(start);
+
+    // exits are emitted lazily, one per address that leaves the region
+    uint16_t exit_addr[JIT_MAX_REGION * 2 + 2];
+    uint8_t  *exit_label[JIT_MAX_REGION * 2 + 2];
+    int      exits = 0;
+
+    if(JIT_CODE_SIZE - jit->used < JIT_MAX_EMIT)
+        jit_flush(jit);
+
+    // breadth-first walk of everything reachable without leaving compilable code
+    memset(index, -1, sizeof(index));
+    addrs[count++] = start;
+    index[start] = 0;
+    for(int i = 0; i < count; i++){
+        uint16_t a = addrs[i];
+        ins[i].op = OP_BAD;
+        if(a > MEMORY_SIZE - 2 || jit->written[a] || jit->written[a+1])
+            continue;
+        ins[i] = decode(mem_op(chip, a));
+        if(!jit_compilable(&ins[i]))
+            continue;
+        uint16_t next[2];
+        int n = 0;
+        if(ins[i].op == OP_JP){
+            next[n++] = ins[i].nnn;
+        }else{
+            next[n++] = a + 2;
+            if(ins[i].op == OP_SE_KK || ins[i].op == OP_SNE_KK || ins[i].op == OP_SE_XY || ins[i].op == OP_SNE_XY)
+                next[n++] = a + 4;
+        }
+        for(int k = 0; k < n; k++){
+            if(next[k] < MEMORY_SIZE && index[next[k]] < 0 && count < JIT_MAX_REGION){
+                index[next[k]] = count;
+                addrs[count++] = next[k];
+            }
+        }
+    }
+
+    Emit e = { jit->code + jit->used };
+    uint8_t *budget_fix[JIT_MAX_REGION];
+    uint8_t *fix[JIT_MAX_REGION * 2];
+    uint16_t fix_to[JIT_MAX_REGION * 2];
+    int fixes = 0;
+
+    for(int i = 0; i < count; i++){
+        uint16_t a = addrs[i];
+        label[i] = e.p;
+        budget_fix[i] = NULL;
+        if(!jit_compilable(&ins[i])){
+            // hand this one back to the interpreter
+            store_pc(&e, a);
+            emit_bytes(&e, "\x89\xF0\xC3", 3);                // mov eax, esi; ret
+            continue;
+        }
+        for(uint16_t b = a; b < a + 2; b++){
+            jit->covered[b] = 1;
+            pages |= 1u << PAGE(b);
+        }
+
+        emit_bytes(&e, "\x83\xEE\x01", 3);                    // sub esi, 1
+        budget_fix[i] = emit_branch(&e, "\x0F\x82", 2);       // jb -> out of budget at a
+
+        uint16_t fall = a + 2;
+        switch(ins[i].op){
+            case OP_JP:
+                fall = ins[i].nnn;
+                break;
+            case OP_SE_KK:
+            case OP_SNE_KK:
+                emit_mem(&e, "\x80", 1, MODRM(7), OFF_V(ins[i].x));   // cmp byte [vx], kk
+                emit8(&e, ins[i].nnn & 0xFF);
+                fix[fixes] = emit_branch(&e, ins[i].op == OP_SE_KK ? "\x0F\x84" : "\x0F\x85", 2);
+                fix_to[fixes++] = a + 4;
+                break;
+            case OP_SE_XY:
+            case OP_SNE_XY:
+                movzx_b(&e, EDX, OFF_V(ins[i].y));
+                emit_mem(&e, "\x38", 1, MODRM(EDX), OFF_V(ins[i].x)); // cmp byte [vx], dl
+                fix[fixes] = emit_branch(&e, ins[i].op == OP_SE_XY ? "\x0F\x84" : "\x0F\x85", 2);
+                fix_to[fixes++] = a + 4;
+                break;
+            default:
+                emit_op(&e, &ins[i]);
+                break;
+        }
+        if(i + 1 < count && addrs[i+1] == fall)
+            continue;                                         // falls through
+        fix[fixes] = emit_branch(&e, "\xE9", 1);              // jmp
+        fix_to[fixes++] = fall;
+    }
+
+    // branch targets outside the region become exits
+    for(int f = 0; f < fixes; f++){
+        uint16_t to = fix_to[f];
+        if(to < MEMORY_SIZE && index[to] >= 0){
+            patch(fix[f], label[index[to]]);
+            continue;
+        }
+        int k;
+        for(k = 0; k < exits && exit_addr[k] != to; k++);
+        if(k == exits){
+            exit_addr[exits] = to;
+            exit_label[exits++] = e.p;
+            store_pc(&e, to);
+            emit_bytes(&e, "\x89\xF0\xC3", 3);                // mov eax, esi; ret
+        }
+        patch(fix[f], exit_label[k]);
+    }
+    // out of budget before running the instruction at a
+    for(int i = 0; i < count; i++){
+        if(budget_fix[i] == NULL)
+            continue;
+        patch(budget_fix[i], e.p);
+        store_pc(&e, addrs[i]);
+        emit_bytes(&e, "\x31\xC0\xC3", 3);                    // xor eax, eax; ret
+    }
+
+    JitFn fn = (JitFn)(void*)(jit->code + jit->used);
+    jit->used = e.p - jit->code;
+    jit->entry[start] = fn;
+    jit->pages[start] = pages;
+    jit->covered[start] = 1;
+    return fn;
+}
+
+// the cpu part of chip8_run_jit(), run_core() with compiled regions wherever possible
+static uint64_t jit_core(Chip8 *chip, uint64_t cycles){
+    uint64_t left = cycles;
+    while(left != 0){
+        uint16_t pc = chip->pc;
+        if(pc < MEMORY_SIZE){
+            JitFn fn = chip->jit->entry[pc];
+            if(fn == NULL)
+                fn = jit_compile(chip, pc);
+            uint32_t budget = left > 0x7FFFFFFF ? 0x7FFFFFFF : (uint32_t)left;
+            uint32_t ran = budget - fn(chip, budget);
+            left -= ran;
+            if(ran != 0 || left == 0)
+                continue;
+        }
+        left -= run_core(chip, 1);
+    }
+    return cycles;
+}
+
+/* like chip8_run(), but through compiled regions wherever possible. without a cache it is chip8_run() */
+uint64_t chip8_run_jit(Chip8 *chip, uint64_t cycles){
+    if (chip->jit == NULL)
+        return chip8_run(chip, cycles);
+    return chip8_run_timed(chip, cycles, jit_core);
+}
+
+#else
+
+int chip8_jit_attach(Chip8 *chip){ (void)chip; return 0; }
+void chip8_jit_detach(Chip8 *chip){ (void)chip; }
+static void jit_reload(Chip8 *chip){ (void)chip; }
+uint64_t chip8_run_jit(Chip8 *chip, uint64_t cycles){ return chip8_run(chip, cycles); }
+
+#endif
+
+/*
+    ahead-of-time recompiler. chip8_load_file() always puts the same image at 0x200, so most of the
+    control flow can be found offline: walk every instruction reachable from 0x200 through
+    fall-through, skips, 1nnn and 2nnn, and write one C label per instruction. jumps between
+    known instructions become gotos, everything with a dynamic target (00EE, Bnnn) goes
+    through a switch on pc, and ops that aren't worth inlining (draws, memory, random, ...)
+    call run_core() for that one step. a pc that lands outside the walked code, or any
+    write onto walked code, drops to run_core() for good. the generated aot_core() is only
+    the cpu, aot_run() wraps it in chip8_run_timed() like every other engine.
+
+        ./chip8 -S IBM.ch8 > IBM.aot.c && cc -O2 -I. IBM.aot.c -o IBM.aot
+*/
+static int aot_inline(const Instr *in){
+    switch(in->op){
+        case OP_JP: case OP_CALL: case OP_RET: case OP_JP_V0:
+        case OP_SE_KK: case OP_SNE_KK: case OP_SE_XY: case OP_SNE_XY:
+        case OP_LD_KK: case OP_ADD_KK: case OP_LD_XY: case OP_OR: case OP_AND: case OP_XOR:
+        case OP_ADD_XY: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LD_I: case OP_ADD_I: case OP_LD_F:
+        case OP_LD_VDT: case OP_LD_DT: case OP_LD_ST: case OP_SKP: case OP_SKNP:
+            return 1;
+    }
+    return 0;
+}
+
+/* goto the label for `to` if it was compiled, otherwise leave through the pc switch */
+static void aot_goto(FILE *out, const uint8_t *reach, uint16_t to){
+    if(to < MEMORY_SIZE && reach[to])
+        fprintf(out, "goto L_%03x;", to);
+    else
+        fprintf(out, "{ chip->pc = 0x%03x; goto dispatch; }", to);
+}
+
+int aot_emit(FILE *out, Chip8 *chip, const char *path){
+    uint8_t reach[MEMORY_SIZE] = {0};
+    uint8_t code[MEMORY_SIZE] = {0};
+    uint16_t work[MEMORY_SIZE];
+    if (chip->variant != CHIP8_VARIANT_CHIP8){
+        fprintf(stderr, "Error: %s isn't a CHIP-8 rom, the recompiler is CHIP-8 only\n", path);
+        return 0;
+    }
+    int nwork = 0, ninstr = 0;
+
+    work[nwork++] = 0x200;
+    reach[0x200] = 1;
+    while(nwork > 0){
+        uint16_t a = work[--nwork];
+        Instr in = decode(mem_op(chip, a));
+        uint16_t next[2];
+        int n = 0;
+        code[a] = code[a+1] = 1;
+        ninstr++;
+        switch(in.op){
+            case OP_JP:     next[n++] = in.nnn; break;
+            case OP_CALL:   next[n++] = in.nnn; next[n++] = a + 2; break;
+            case OP_RET:
+            case OP_JP_V0:
+            case OP_BAD:    break;
+            case OP_SE_KK: case OP_SNE_KK: case OP_SE_XY: case OP_SNE_XY: case OP_SKP: case OP_SKNP:
+                            next[n++] = a + 2; next[n++] = a + 4; break;
+            default:        next[n++] = a + 2; break;
+        }
+        for(int k = 0; k < n; k++){
+            if(next[k] <= MEMORY_SIZE - 2 && !reach[next[k]]){
+                reach[next[k]] = 1;
+                work[nwork++] = next[k];
+            }
+        }
+    }
+
+    fprintf(out, "/* generated by chip8 -S from %s, %d instructions. do not edit */\n", path, ninstr);
+    fprintf(out, "#include \"chip8.c\"\n\n");
+
+    fprintf(out, "static const uint8_t rom_image[%zu] = {", chip->rom_size);
+    for(size_t i = 0; i < chip->rom_size; i++)
+        fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n    ", mem_read(chip, 0x200 + i));
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "/* bytes the code below was compiled from */\n");
+    fprintf(out, "static const uint8_t code_map[MEMORY_SIZE] = {");
+    for(int i = 0; i < MEMORY_SIZE; i++)
+        if(code[i])
+            fprintf(out, " [0x%03x] = 1,", i);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "static void code_write(Chip8 *chip, uint16_t addr){\n"
+                 "    (void)addr;\n"
+                 "    chip->code_map = NULL; // the compiled code no longer matches memory\n"
+                 "}\n\n");
+
+    fprintf(out, "#define STEP(a) if (left == 0) { chip->pc = a; goto out; } left--;\n\n");
+    fprintf(out, "static uint64_t aot_core(Chip8 *chip, uint64_t cycles){\n");
+    fprintf(out, "    uint64_t left = cycles;\n");
+    fprintf(out, "    uint8_t *v = chip->v;\n");
+    fprintf(out, "    uint16_t sum;\n");
+    fprintf(out, "    (void)sum;\n\n");
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    if (chip->code_map == NULL) goto interp;\n");
+    fprintf(out, "    switch (chip->pc){\n");
+    for(int a = 0; a < MEMORY_SIZE; a++)
+        if(reach[a])
+            fprintf(out, "        case 0x%03x: goto L_%03x;\n", a, a);
+    fprintf(out, "        default: goto interp;\n    }\n\n");
+
+    for(int a = 0; a < MEMORY_SIZE; a++){
+        if(!reach[a])
+            continue;
+        Instr in = decode(mem_op(chip, a));
+        int x = in.x, y = in.y, kk = in.nnn & 0xFF;
+        fprintf(out, "L_%03x: STEP(0x%03x) ", a, a);
+        if(!aot_inline(&in)){
+            // one step through the interpreter, then carry on from wherever it left pc
+            fprintf(out, "chip->pc = 0x%03x; run_core(chip, 1); ", a);
+            if(in.op == OP_BAD || !reach[a+2])
+                fprintf(out, "goto dispatch;\n");
+            else
+                fprintf(out, "if (chip->code_map == NULL) goto interp; if (chip->pc == 0x%03x) goto L_%03x; goto dispatch;\n",
+                        a + 2, a + 2);
+            continue;
+        }
+        switch(in.op){
+            case OP_JP:     break;
+            case OP_CALL:   fprintf(out, "chip->stack[++chip->sp & (MAX_SUBROUTINES-1)] = 0x%03x; ", a); break;
+            case OP_RET:    fprintf(out, "chip->pc = chip->stack[chip->sp-- & (MAX_SUBROUTINES-1)] + 2; goto dispatch;\n"); continue;
+            case OP_JP_V0:  fprintf(out, "chip->pc = 0x%03x + v[0]; goto dispatch;\n", in.nnn); continue;
+            case OP_SE_KK:  fprintf(out, "if (v[%d] == %d) ", x, kk); aot_goto(out, reach, a + 4); break;
+            case OP_SNE_KK: fprintf(out, "if (v[%d] != %d) ", x, kk); aot_goto(out, reach, a + 4); break;
+            case OP_SE_XY:  fprintf(out, "if (v[%d] == v[%d]) ", x, y); aot_goto(out, reach, a + 4); break;
+            case OP_SNE_XY: fprintf(out, "if (v[%d] != v[%d]) ", x, y); aot_goto(out, reach, a + 4); break;
+            case OP_SKP:    fprintf(out, "if (chip->keys >> (v[%d] & 15) & 1) ", x); aot_goto(out, reach, a + 4); break;
+            case OP_SKNP:   fprintf(out, "if (!(chip->keys >> (v[%d] & 15) & 1)) ", x); aot_goto(out, reach, a + 4); break;
+            case OP_LD_KK:  fprintf(out, "v[%d] = %d;", x, kk); break;
+            case OP_ADD_KK: fprintf(out, "v[%d] += %d;", x, kk); break;
+            case OP_LD_XY:  fprintf(out, "v[%d] = v[%d];", x, y); break;
+            case OP_OR:     fprintf(out, "v[%d] |= v[%d];", x, y); break;
+            case OP_AND:    fprintf(out, "v[%d] &= v[%d];", x, y); break;
+            case OP_XOR:    fprintf(out, "v[%d] ^= v[%d];", x, y); break;
+            case OP_ADD_XY: fprintf(out, "sum = v[%d] + v[%d]; v[15] = sum > 0xFF; v[%d] = sum & 0xFF;", x, y, x); break;
+            case OP_SUB:    fprintf(out, "v[15] = v[%d] >= v[%d]; v[%d] = v[%d] - v[%d];", x, y, x, x, y); break;
+            case OP_SUBN:   fprintf(out, "v[15] = v[%d] >= v[%d]; v[%d] = v[%d] - v[%d];", y, x, x, y, x); break;
+            case OP_SHR:    fprintf(out, "v[15] = v[%d] & 0x1; v[%d] >>= 1;", x, x); break;
+            case OP_SHL:    fprintf(out, "v[15] = (v[%d] & 0x80) >> 7; v[%d] <<= 1;", x, x); break;
+            case OP_LD_I:   fprintf(out, "chip->I = 0x%03x;", in.nnn); break;
+            case OP_ADD_I:  fprintf(out, "chip->I += v[%d];", x); break;
+            case OP_LD_F:   fprintf(out, "chip->I = v[%d] * 5;", x); break;
+            case OP_LD_VDT: fprintf(out, "v[%d] = chip->delayTimer;", x); break;
+            case OP_LD_DT:  fprintf(out, "chip->delayTimer = v[%d];", x); break;
+            case OP_LD_ST:  fprintf(out, "chip->soundTimer = v[%d];", x); break;
+        }
+        fprintf(out, " ");
+        // fall into the next label when that is where the instruction goes anyway
+        uint16_t fall = in.op == OP_JP || in.op == OP_CALL ? in.nnn : a + 2;
+        if(fall != a + 2 || !reach[a+2] || reach[a+1])
+            aot_goto(out, reach, fall);
+        fprintf(out, "\n");
+    }
+
+    fprintf(out, "\ninterp:\n");
+    fprintf(out, "    while (left != 0){\n");
+    fprintf(out, "        left--;\n");
+    fprintf(out, "        run_core(chip, 1);\n");
+    fprintf(out, "        if (chip->code_map != NULL && chip->pc < MEMORY_SIZE && code_map[chip->pc]) goto dispatch;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "out:\n");
+    fprintf(out, "    return cycles - left;\n}\n\n");
+    fprintf(out, "uint64_t aot_run(Chip8 *chip, uint64_t cycles){\n");
+    fprintf(out, "    return chip8_run_timed(chip, cycles, aot_core);\n}\n\n");
+
+    fprintf(out, "int main(int argc, char **argv){\n");
+    fprintf(out, "    uint64_t max_cycles = argc > 1 ? strtoull(argv[1], NULL, 0) : 20000000;\n");
+    fprintf(out, "    Chip8 *chip = chip8_create(argc > 2 ? strtoull(argv[2], NULL, 0) : 0);\n");
+    fprintf(out, "    if (chip == NULL)\n        return 1;\n");
+    fprintf(out, "    chip8_load_rom(chip, rom_image, sizeof(rom_image));\n");
+    fprintf(out, "    chip->code_map = code_map;\n");
+    fprintf(out, "    chip->code_write = code_write;\n");
+    fprintf(out, "    run_headless(chip, \"%s (aot)\", max_cycles, 0, aot_run);\n", path);
+    fprintf(out, "    chip8_destroy(chip);\n");
+    fprintf(out, "    return 0;\n}\n");
+    return ninstr;
+}
+
+static int chip8_reset(Chip8 *chip, uint64_t seed){
+    // registers and screen start zeroed; headless runs hash the screen. memory starts out
+    // as the pages of the empty rom's image, the fonts and nothing else
+    if (!chip8_load_rom(chip, (const uint8_t*)"", 0))
+        return 0;
+    // print_emulator_memory_space(chip);
+    chip->pc = 0x200;
+    chip->planes = 1;
+    chip8_set_ips(chip, DEFAULT_IPS);
+    chip8_seed(chip, seed);
+    chip->next_input = NO_INPUT;
+    // chip->I = 0x200;
+    // chip->opcode = 0x0;
+    chip->sp = 0;
+    return 1;
+}
+
+size_t chip8_size(void){
+    return sizeof(Chip8);
+}
+
+Chip8* chip8_create(uint64_t seed){
+    Chip8 *chip = (Chip8*)calloc(1, sizeof(Chip8));
+    if(chip == NULL){
+        fprintf(stderr, "%s", "Error: allocating chip8\n");
+        return NULL;
+    }
+    chip->owned = 1;
+    if (!chip8_reset(chip, seed)){
+        free(chip);
+        return NULL;
+    }
+    return chip;
+}
+
+/* build a chip in mem, which the caller owns and frees after chip8_destroy() */
+Chip8* chip8_create_in(void *mem, size_t size, uint64_t seed){
+    if (mem == NULL || size < sizeof(Chip8) || (uintptr_t)mem % _Alignof(Chip8) != 0)
+        return NULL;
+    Chip8 *chip = (Chip8*)mem;
+    memset(chip, 0, sizeof(Chip8));
+    return chip8_reset(chip, seed) ? chip : NULL;
+}
+
+/*
+    make dst (not yet a chip, or released with mem_release()) the same machine as src: it
+    shares src's image and gets copies of src's own pages. engines, traces and replays
+    attached to src are not carried over.
+*/
+static void chip8_copy(Chip8 *dst, const Chip8 *src){
+    *dst = *src;
+    if (src->ext != NULL){
+        if ((dst->ext = (struct Ext*)malloc(sizeof(struct Ext))) == NULL){
+            fprintf(stderr, "%s", "Error: allocating a hires screen\n");
+            exit(1);
+        }
+        memcpy(dst->ext, src->ext, sizeof(struct Ext));
+    }
+    memset(OWN_MEM(dst, dst->mask), 0, (dst->pages + 63) / 64 * sizeof(uint64_t));
+    memset(OWN_CODE(dst, dst->mask), 0, (dst->pages + 63) / 64 * sizeof(uint64_t));
+    dst->trace = NULL;
+    dst->grams = NULL;
+    dst->debug = NULL;
+#ifdef CHIP8_PROFILE
+    dst->prof = NULL;
+#endif
+    dst->jit = NULL;
+    dst->input = NULL;
+    dst->next_input = NO_INPUT;
+    dst->code_map = NULL;
+    dst->owned = 0;
+    pthread_mutex_lock(&rom_cache_lock);
+    dst->image->refs++;
+    pthread_mutex_unlock(&rom_cache_lock);
+    uint16_t mask = src->mask;
+    for (int p = 0; p < src->pages; p++){
+        if (OWNS(OWN_MEM(src, mask), p)){
+            MEM_TAB(dst, mask)[p] = src->image->memory + p * MEM_PAGE_SIZE;
+            mem_own(dst, p, mask);
+            memcpy(MEM_TAB(dst, mask)[p], MEM_TAB(src, mask)[p], MEM_PAGE_SIZE);
+        }
+        if (OWNS(OWN_CODE(src, mask), p)){
+            CODE_TAB(dst, mask)[p] = src->image->decoded + p * MEM_PAGE_SIZE;
+            code_own(dst, p, mask);
+            memcpy(CODE_TAB(dst, mask)[p], CODE_TAB(src, mask)[p], MEM_PAGE_SIZE * sizeof(Instr));
+        }
+    }
+    if (src->debug != NULL)
+        debug_unmark(dst, src->debug);
+}
+
+/* drop the recompiler, the trace, the op counts and the debugger; a replay attached with chip8_input_attach() is the caller's */
+void chip8_destroy(Chip8 *chip){
+    if (chip == NULL)
+        return;
+    chip8_jit_detach(chip);
+    chip8_debug_detach(chip);
+    chip8_trace_detach(chip);
+    prof_close(chip);
+    free(chip->grams);
+    mem_release(chip);
+    free(chip->ext);
+    if (chip->owned)
+        free(chip);
+}
+
+void printState(Chip8 *chip){
+    print_screen_debug(chip);
+    // printf("opcode: 0x%04x\n", chip->opcode);
+    // printf("PC:     0x%x\n", chip->pc);
+    // printf("I:      0x%x\n", chip->I);
+    // printf("sp:     %x\n", chip->sp);
+    // printf("Vf:     0x%04x\n", chip->v[0xF]);
+    // printf("instr at pc: 0x%02x%02x\n", chip->memory[chip->pc], chip->memory[chip->pc+1] );
+    // print_filled_registers(chip);
+    // print_stack(chip);
+    // print_rom_in_memory(chip);
+    
+}
+
+
+
+/*
+    snapshots. the whole machine (registers, stack, timers, clock, rng, screen, memory) as a
+    fixed size, little endian, versioned blob:
+
+        "C8SN" version:u16 pc:u16 I:u16 sp:u16 stack:16*u16 v:16*u8 dt:u8 st:u8
+        cycles:u64 next_tick:u64 ipf:u32 rng:u64 rom_size:u32 keys:u16 screen:32*u64 memory:4096
+
+    caches (decoded ops, compiled code, the trace) aren't part of it; chip8_load() invalidates
+    them for every byte of memory it changes, exactly as if the guest had written it.
+*/
+#define SNAP_MAGIC      "C8SN"
+#define SNAP_VERSION    2           // 2: keys
+#define SNAP_SIZE       (4 + 2 + 3 * 2 + MAX_SUBROUTINES * 2 + NUM_REGS + 2 + 8 + 8 + 4 + 8 + 4 + 2 \
+                         + HEIGHT * 8 + MEMORY_SIZE)
+_Static_assert(SNAP_SIZE == CHIP8_SNAP_SIZE, "chip8.h has the wrong snapshot size");
+
+/*
+    write chip's state into buf, which must hold SNAP_SIZE bytes. returns SNAP_SIZE, or 0 for
+    a SUPER-CHIP or XO-CHIP machine: the format has no room for their screens and memory
+*/
+size_t chip8_save(const Chip8 *chip, uint8_t *buf){
+    if (chip->variant != CHIP8_VARIANT_CHIP8)
+        return 0;
+    uint8_t *p = buf;
+    memcpy(p, SNAP_MAGIC, 4);
+    p += 4;
+    p = put_le(p, SNAP_VERSION, 2);
+    p = put_le(p, chip->pc, 2);
+    p = put_le(p, chip->I, 2);
+    p = put_le(p, chip->sp, 2);
+    for (int i = 0; i < MAX_SUBROUTINES; i++)
+        p = put_le(p, chip->stack[i], 2);
+    memcpy(p, chip->v, NUM_REGS);
+    p += NUM_REGS;
+    *p++ = chip->delayTimer;
+    *p++ = chip->soundTimer;
+    p = put_le(p, chip->cycles, 8);
+    p = put_le(p, chip->next_tick, 8);
+    p = put_le(p, chip->ipf, 4);
+    p = put_le(p, chip->rng, 8);
+    p = put_le(p, chip->rom_size, 4);
+    p = put_le(p, chip->keys, 2);
+    for (int y = 0; y < HEIGHT; y++)
+        p = put_le(p, chip->screen[y], 8);
+    for (int pg = 0; pg < MEM_PAGES; pg++)
+        memcpy(p + pg * MEM_PAGE_SIZE, chip->mem[pg], MEM_PAGE_SIZE);
+    return SNAP_SIZE;
+}
+
+#define SNAP_MEM        (SNAP_SIZE - MEMORY_SIZE)   // where memory starts in a snapshot
+
+// everything but memory from the snapshot in buf into chip
+static void snap_load_cpu(Chip8 *chip, const uint8_t *buf){
+    const uint8_t *p = buf + 4 + 2;
+    chip->pc = get_le(&p, 2);
+    chip->I = get_le(&p, 2);
+    chip->sp = get_le(&p, 2);
+    for (int i = 0; i < MAX_SUBROUTINES; i++)
+        chip->stack[i] = get_le(&p, 2);
+    memcpy(chip->v, p, NUM_REGS);
+    p += NUM_REGS;
+    chip->delayTimer = *p++;
+    chip->soundTimer = *p++;
+    chip->cycles = get_le(&p, 8);
+    chip->next_tick = get_le(&p, 8);
+    chip->ipf = get_le(&p, 4);
+    chip->rng = get_le(&p, 8);
+    chip->rom_size = get_le(&p, 4);
+    chip->keys = get_le(&p, 2);
+    for (int y = 0; y < HEIGHT; y++)
+        chip->screen[y] = get_le(&p, 8);
+    chip->screen_dirty = 1;
+    input_seek(chip);
+}
+
+/* put chip in the state saved in buf. returns 0 (and leaves chip alone) if buf isn't a snapshot */
+int chip8_load(Chip8 *chip, const uint8_t *buf, size_t size){
+    const uint8_t *p = buf + 4;
+    if (chip->variant != CHIP8_VARIANT_CHIP8 || size != SNAP_SIZE || memcmp(buf, SNAP_MAGIC, 4) != 0 || get_le(&p, 2) != SNAP_VERSION)
+        return 0;
+    // the clock has to make sense or the timed run loop would never get to a tick
+    const uint8_t *clk = p + 3 * 2 + MAX_SUBROUTINES * 2 + NUM_REGS + 2;
+    uint64_t cycles = get_le(&clk, 8), next_tick = get_le(&clk, 8), ipf = get_le(&clk, 4);
+    if (ipf == 0 || next_tick <= cycles || next_tick - cycles > ipf)
+        return 0;
+    for (int i = 0; i < MEMORY_SIZE; i++)
+        if (mem_read(chip, i) != buf[SNAP_MEM + i])
+            mem_write(chip, i, buf[SNAP_MEM + i]);
+    snap_load_cpu(chip, buf);
+    return 1;
+}
+
+/* save chip to a file, chip8_load_file() takes it back in place of a rom */
+int chip8_save_file(const Chip8 *chip, const char *path){
+    uint8_t buf[SNAP_SIZE];
+    size_t n = chip8_save(chip, buf);
+    if (n == 0){
+        fprintf(stderr, "%s", "Error: only CHIP-8 machines can be snapshotted\n");
+        return 0;
+    }
+    FILE *f = fopen(path, "wb");
+    if (f == NULL){
+        fprintf(stderr, "Error: could not create snapshot %s\n", path);
+        return 0;
+    }
+    int ok = fwrite(buf, 1, n, f) == n;
+    ok = fclose(f) == 0 && ok;
+    if (!ok)
+        fprintf(stderr, "Error: writing snapshot %s\n", path);
+    return ok;
+}
+
+/*
+    rewind. one snapshot per frame for the last few seconds, each kept as its xor with the
+    keyframe before it (a keyframe: with all zeroes) and run-length coded as repeated
+    (zero run, literal run, literal bytes) with varint runs. frame to frame hardly anything
+    but the clock, timers and a couple of registers moves, so a frame takes a few dozen bytes
+    and a keyframe, every REWIND_KEY frames, a few hundred. the oldest frames are dropped
+    first, a keyframe together with every frame that depends on it.
+*/
+#define REWIND_KEY  60
+#define RLE_MAX     (SNAP_SIZE + SNAP_SIZE / 64 + 16)   // worst case encoding
+
+typedef struct RewindFrame {
+    uint8_t         *data;          // rle of snapshot ^ keyframe
+    uint32_t        len;
+    uint32_t        key;            // slot of the keyframe it is relative to, its own if a keyframe
+} RewindFrame;
+
+struct Chip8Rewind {
+    RewindFrame     *frame;         // ring of cap slots, count of them in use from first
+    size_t          cap, first, count;
+    size_t          bytes;          // encoded bytes held
+    uint8_t         key[SNAP_SIZE]; // newest keyframe, new frames are coded against it
+    uint32_t        key_slot, since_key;
+    uint8_t         key_stale;      // a restore moved key_slot, key is decoded again at the next push
+    uint8_t         cur[SNAP_SIZE]; // the newest frame, as cur_chip still is
+    const Chip8     *cur_chip;      // NULL if no chip is known to be in that state
+    uint64_t        cur_cycles;     // its clock then, if it has moved since the chip has too
+};
+
+static uint8_t *put_varint(uint8_t *p, size_t val){
+    while (val >= 0x80){
+        *p++ = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    *p++ = val;
+    return p;
+}
+
+static size_t get_varint(const uint8_t **p){
+    size_t val = 0;
+    for (int shift = 0; ; shift += 7){
+        uint8_t b = *(*p)++;
+        val |= (size_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return val;
+    }
+}
+
+/* rle of a ^ b (b NULL: a alone) into out, which must hold RLE_MAX. returns its length */
+static size_t rle_xor(const uint8_t *a, const uint8_t *b, uint8_t *out){
+    uint8_t *p = out;
+    size_t i = 0;
+    while (i < SNAP_SIZE){
+        size_t zeros = i, lit;
+        while (zeros < SNAP_SIZE && a[zeros] == (b ? b[zeros] : 0))
+            zeros++;
+        // a literal run ends at the first two equal bytes in a row
+        for (lit = zeros; lit < SNAP_SIZE; lit++)
+            if (a[lit] == (b ? b[lit] : 0) && (lit + 1 == SNAP_SIZE || a[lit + 1] == (b ? b[lit + 1] : 0)))
+                break;
+        p = put_varint(p, zeros - i);
+        p = put_varint(p, lit - zeros);
+        for (size_t k = zeros; k < lit; k++)
+            *p++ = a[k] ^ (b ? b[k] : 0);
+        i = lit;
+    }
+    return p - out;
+}
+
+/*
+    dst ^= what rle_xor() encoded, in time proportional to the encoding. with a chip, the
+    memory bytes of the snapshot that change are written to its memory as well
+*/
+static void rle_apply(const uint8_t *rle, size_t len, uint8_t *dst, Chip8 *chip){
+    const uint8_t *p = rle, *end = rle + len;
+    size_t at = 0;
+    while (p < end){
+        at += get_varint(&p);
+        size_t lit = get_varint(&p);
+        for (size_t k = 0; k < lit; k++, at++){
+            dst[at] ^= *p++;
+            if (chip != NULL && at >= SNAP_MEM)
+                mem_write(chip, at - SNAP_MEM, dst[at]);
+        }
+    }
+}
+
+static void rewind_apply(Chip8Rewind *r, size_t slot, uint8_t *dst, Chip8 *chip){
+    rle_apply(r->frame[slot].data, r->frame[slot].len, dst, chip);
+}
+
+/* history of the last `seconds` of frames */
+Chip8Rewind *chip8_rewind_create(double seconds){
+    Chip8Rewind *r = (Chip8Rewind*)calloc(1, sizeof(Chip8Rewind));
+    if (r == NULL)
+        return NULL;
+    // room for a whole extra keyframe group, so dropping one never goes below `seconds`
+    r->cap = (size_t)(seconds * TIMER_HZ) + REWIND_KEY + 1;
+    r->frame = (RewindFrame*)calloc(r->cap, sizeof(RewindFrame));
+    if (r->frame == NULL){
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+static void rewind_drop(Chip8Rewind *r, size_t slot){
+    r->bytes -= r->frame[slot].len;
+    free(r->frame[slot].data);
+    r->frame[slot].data = NULL;
+}
+
+void chip8_rewind_destroy(Chip8Rewind *r){
+    for (size_t i = 0; i < r->count; i++)
+        rewind_drop(r, (r->first + i) % r->cap);
+    free(r->frame);
+    free(r);
+}
+
+/* remember chip as the newest frame. there's no history of SUPER-CHIP or XO-CHIP machines */
+void chip8_rewind_push(Chip8Rewind *r, const Chip8 *chip){
+    uint8_t snap[SNAP_SIZE], rle[RLE_MAX];
+    if (chip8_save(chip, snap) == 0)
+        return;
+    if (r->count == r->cap){
+        // drop the oldest keyframe and everything coded against it
+        do {
+            rewind_drop(r, r->first);
+            r->first = (r->first + 1) % r->cap;
+            r->count--;
+        } while (r->count > 0 && r->frame[r->first].key != r->first);
+    }
+    size_t slot = (r->first + r->count) % r->cap;
+    int keyframe = r->count == 0 || ++r->since_key >= REWIND_KEY;
+    if (!keyframe && r->key_stale){
+        memset(r->key, 0, SNAP_SIZE);
+        rewind_apply(r, r->key_slot, r->key, NULL);
+    }
+    r->key_stale = 0;
+    size_t len = rle_xor(snap, keyframe ? NULL : r->key, rle);
+    RewindFrame *f = &r->frame[slot];
+    f->data = (uint8_t*)malloc(len);
+    r->cur_chip = NULL;
+    if (f->data == NULL)
+        return;
+    memcpy(f->data, rle, len);
+    f->len = len;
+    if (keyframe){
+        memcpy(r->key, snap, SNAP_SIZE);
+        r->key_slot = slot;
+        r->since_key = 0;
+    }
+    f->key = r->key_slot;
+    r->bytes += len;
+    r->count++;
+    memcpy(r->cur, snap, SNAP_SIZE);
+    r->cur_chip = chip;
+    r->cur_cycles = chip->cycles;
+}
+
+/*
+    put chip back to how it was `back` frames before the newest one (0: the newest) and forget
+    the frames after it, history goes on from there. returns 0 if there aren't that many.
+    frames are xors, so going from the newest frame to another one is undoing the newest's
+    delta and doing the other's (and swapping keyframes in between if they differ). a chip
+    still where the last push or restore left it gets only those bytes written, in time
+    proportional to the deltas plus the fixed registers and screen. any other chip gets the
+    whole decoded frame through chip8_load().
+*/
+int chip8_rewind_restore(Chip8Rewind *r, Chip8 *chip, size_t back){
+    if (back >= r->count)
+        return 0;
+    size_t slot = (r->first + r->count - 1 - back) % r->cap;
+    size_t newest = (r->first + r->count - 1) % r->cap;
+    size_t key = r->frame[slot].key, from = r->frame[newest].key;
+    if (r->cur_chip == chip && chip->cycles == r->cur_cycles && chip->variant == CHIP8_VARIANT_CHIP8){
+        if (newest != from)
+            rewind_apply(r, newest, r->cur, chip);
+        if (key != from){
+            rewind_apply(r, from, r->cur, chip);        // back to all zeroes
+            rewind_apply(r, key, r->cur, chip);
+        }
+        if (slot != key)
+            rewind_apply(r, slot, r->cur, chip);
+        snap_load_cpu(chip, r->cur);
+    } else {
+        memset(r->cur, 0, SNAP_SIZE);
+        rewind_apply(r, key, r->cur, NULL);
+        if (slot != key)
+            rewind_apply(r, slot, r->cur, NULL);
+        if (!chip8_load(chip, r->cur, SNAP_SIZE)){
+            r->cur_chip = NULL;
+            return 0;
+        }
+    }
+    r->cur_chip = chip;
+    r->cur_cycles = chip->cycles;
+
+    for (; back > 0; back--){
+        r->count--;
+        rewind_drop(r, (r->first + r->count) % r->cap);
+    }
+    if (key != r->key_slot){
+        r->key_slot = key;
+        r->key_stale = 1;
+    }
+    r->since_key = (slot + r->cap - key) % r->cap;
+    return 1;
+}
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static size_t max_rom_size(int variant){
+    return variant == CHIP8_VARIANT_XOCHIP ? XO_MAX_ROM_SIZE : MAX_ROM_SIZE;
+}
+
+/*
+    a new rom starts on a clean cpu and screen, like chip8_reset() does it minus the seed: the
+    rng stream, the speed and whatever is attached (replay, jit, debugger, ...) carry on
+*/
+static void cpu_reset(Chip8 *chip){
+    chip->pc = 0x200;
+    chip->I = chip->opcode = chip->sp = 0;
+    memset(chip->stack, 0, sizeof(chip->stack));
+    memset(chip->v, 0, sizeof(chip->v));
+    memset(chip->flags, 0, sizeof(chip->flags));
+    chip->delayTimer = chip->soundTimer = 0;
+    chip->keys = 0;
+    chip->cycles = 0;
+    chip->next_tick = chip->ipf;
+    chip->hires = 0;
+    chip->planes = 1;
+    clear_screen(chip);
+    chip->screen_dirty = 1;
+    input_seek(chip);
+}
+
+/* put rom in memory at 0x200 over a clean `variant` machine, which chip becomes */
+static int load_rom_as(Chip8 *chip, const uint8_t *rom, size_t rom_size, int variant){
+    if (rom_size > max_rom_size(variant)){
+        fprintf(stderr, "%s", "Error: rom size larger than available space\n");
+        return 0;
+    }
+    RomImage *img = rom_image_get(rom, rom_size, variant);
+    if (img == NULL){
+        fprintf(stderr, "%s", "Error: allocating rom image\n");
+        return 0;
+    }
+    struct Ext *ext = chip->ext;
+    if (variant != CHIP8_VARIANT_CHIP8 && ext == NULL && (ext = (struct Ext*)calloc(1, sizeof(struct Ext))) == NULL){
+        fprintf(stderr, "%s", "Error: allocating a hires screen\n");
+        rom_image_put(img);
+        return 0;
+    }
+    if (variant != chip->variant){
+        mem_release(chip);      // through the old machine's page tables
+        if (variant == CHIP8_VARIANT_CHIP8){
+            free(ext);
+            ext = NULL;
+        }
+        chip->ext = ext;
+    }
+    mem_attach(chip, img);
+    chip->rom_size = rom_size;
+    cpu_reset(chip);
+    return 1;
+}
+
+/* put rom in chip's memory at 0x200 over a clean machine of its variant with the fonts in
+   place: memory, cpu and screen as they are at power on */
+int chip8_load_rom(Chip8 *chip, const uint8_t *rom, size_t rom_size){
+    return load_rom_as(chip, rom, rom_size, chip->variant);
+}
+
+static const char *variant_names[CHIP8_VARIANTS] = { "chip8", "schip", "xochip" };
+
+int chip8_variant_named(const char *name){
+    for (int v = 0; v < CHIP8_VARIANTS; v++)
+        if (strcmp(name, variant_names[v]) == 0)
+            return v;
+    return -1;
+}
+
+int chip8_variant(const Chip8 *chip){
+    return chip->variant;
+}
+
+/* make chip an empty `variant` machine. chip8_load_file() keeps to it from then on */
+int chip8_set_variant(Chip8 *chip, int variant){
+    if (variant < 0 || variant >= CHIP8_VARIANTS)
+        return 0;
+    if (variant != chip->variant && !load_rom_as(chip, (const uint8_t*)"", 0, variant))
+        return 0;
+    chip->variant_set = 1;
+    return 1;
+}
+
+// the machine a rom file is for, by its extension
+static int variant_of(const char *path){
+    const char *ext = strrchr(path, '.');
+    if (ext != NULL && strcasecmp(ext, ".sc8") == 0)
+        return CHIP8_VARIANT_SCHIP;
+    if (ext != NULL && strcasecmp(ext, ".xo8") == 0)
+        return CHIP8_VARIANT_XOCHIP;
+    return CHIP8_VARIANT_CHIP8;
+}
+
+/* map the file and load it straight from the page cache, no read buffer in between */
+int chip8_load_file(Chip8 *chip, char* path){
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        fprintf(stderr, "Error: could not open file in <path>: %s\n", path);
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+        fprintf(stderr, "Error: %s is not a rom file\n", path);
+        close(fd);
+        return 0;
+    }
+    size_t rom_size = (size_t)st.st_size;
+    int variant = chip->variant_set ? chip->variant : variant_of(path);
+    // snapshots are CHIP-8 only and bigger than any CHIP-8 rom. an XO-CHIP rom can be any
+    // size up to 64 KB, so one for that machine is always taken as a rom
+    int snapshot = variant == CHIP8_VARIANT_CHIP8 && rom_size == SNAP_SIZE;
+    if (rom_size > max_rom_size(variant) && !snapshot){
+        fprintf(stderr, "Error: %s is %zu bytes, a rom can be at most %zu\n", path, rom_size,
+                max_rom_size(variant));
+        close(fd);
+        return 0;
+    }
+    if (rom_size == 0){
+        close(fd);
+        return load_rom_as(chip, (const uint8_t*)"", 0, variant);  // there's nothing to map
+    }
+    const uint8_t *rom = (const uint8_t*)mmap(NULL, rom_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(rom == MAP_FAILED){
+        fprintf(stderr, "Error: could not map %s\n", path);
+        return 0;
+    }
+
+    int ok;
+    if (snapshot && memcmp(rom, SNAP_MAGIC, 4) == 0){
+        ok = (chip->variant == CHIP8_VARIANT_CHIP8 || load_rom_as(chip, (const uint8_t*)"", 0, variant))
+            && chip8_load(chip, rom, rom_size);
+        if (!ok)
+            fprintf(stderr, "Error: %s is a snapshot from an incompatible version\n", path);
+    } else {
+        ok = load_rom_as(chip, rom, rom_size, variant);
+    }
+
+    munmap((void*)rom, rom_size);
+    return ok;
+}
+
+
+
+/*
+    FNV-1a over the screen packed one bit per pixel, 8 bytes per row (left-most pixel in the
+    high bit). stays the same no matter how the screen is stored.
+*/
+uint64_t chip8_screen_hash(Chip8 *chip){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int words = chip->hires ? SCREEN_WORDS : HEIGHT;
+    int planes = chip->variant == CHIP8_VARIANT_XOCHIP ? 2 : 1;  // XO-CHIP's plane 1 after plane 0
+    for(int p = 0; p < planes; p++){
+        for(int i = 0; i < words; i++){
+            uint64_t row = screen_plane(chip, p)[i];
+            for(int b = 56; b >= 0; b -= 8){
+                h ^= (row >> b) & 0xFF;
+                h *= 0x100000001b3ULL;
+            }
+        }
+    }
+    return h;
+}
+
+/*
+    run the rom with no sleeps and no output until either the cycle budget or the time
+    budget (in seconds) runs out, whichever is set. then report the throughput.
+*/
+void run_headless(Chip8 *chip, const char *path, uint64_t max_cycles, double max_seconds,
+                  uint64_t (*run)(Chip8 *, uint64_t)){
+    const uint64_t check_every = 1 << 16; // how many instructions between clock reads
+    uint64_t deadline = max_seconds > 0 ? (uint64_t)(max_seconds * 1e9) : 0;
+    uint64_t cycles = 0;
+    uint64_t start = now_ns();
+    uint64_t elapsed = 0;
+
+    while(max_cycles == 0 || cycles < max_cycles){
+        uint64_t n = check_every;
+        if (max_cycles != 0 && max_cycles - cycles < n)
+            n = max_cycles - cycles;
+        cycles += run(chip, n);
+        elapsed = now_ns() - start;
+        if (deadline != 0 && elapsed >= deadline)
+            break;
+    }
+    elapsed = now_ns() - start;
+
+    double secs = elapsed / 1e9;
+    printf("rom:        %s\n", path);
+    printf("cycles:     %llu\n", (unsigned long long)cycles);
+    printf("time:       %.3f s\n", secs);
+    printf("ips:        %.0f\n", secs > 0 ? cycles / secs : 0.0);
+    printf("ns/instr:   %.2f\n", cycles ? (double)elapsed / cycles : 0.0);
+    printf("fb hash:    0x%016llx\n", (unsigned long long)chip8_screen_hash(chip));
+    printf("pc/I/sp:    0x%03x 0x%03x %d\n", chip->pc, chip->I, chip->sp);
+    printf("v:         ");
+    for(int i = 0; i < NUM_REGS; i++)
+        printf(" %02x", chip->v[i]);
+    printf("\n");
+}
+
+/*
+    the debugger's command loop (-d), one command a line from in: a script, or the terminal,
+    which gets a prompt. addresses and counts are expressions too.
+
+        break ADDR [if COND]            b   stop before the instruction at ADDR
+        watch [r|w|rw] WHAT [if COND]   w   stop before whatever reads/writes WHAT (default w):
+                                            v0-vf, i, ADDR or ADDR-ADDR
+        delete ID                       d
+        info                                the points, and how often each stopped
+        continue [N]                    c   run to the next stop, or at most N instructions
+        step [N]                        s   N instructions (default 1), unless something stops first
+        regs                            r
+        print EXPR                      p
+        x ADDR [LEN]                        memory
+        dis [ADDR [N]]                      disassemble, from pc by default
+        screen
+        quit                            q
+
+    continue with no N stops after max_cycles (0: runs until something stops it). 0 if any
+    command failed, for scripts.
+*/
+static void debug_where(Chip8 *chip){
+    char text[32];
+    uint16_t opcode = mem_read(chip, chip->pc) << 8 | mem_read(chip, chip->pc + 1);
+    printf("0x%03x: %04x  %s\n", chip->pc, opcode, chip8_disasm(opcode, chip->variant, text, sizeof(text)));
+}
+
+static void debug_run(Chip8 *chip, uint64_t n){
+    const uint64_t chunk = 1 << 16;
+    uint64_t ran = 0;
+    int id = 0;
+    while ((n == 0 || ran < n) && id == 0){
+        ran += chip8_run(chip, n == 0 || n - ran > chunk ? chunk : n - ran);
+        id = chip8_debug_stopped(chip);
+    }
+    if (id != 0)
+        printf("%d: %s, stopped after %llu at cycle %llu\n", id, chip->debug->points[id - 1].text,
+               (unsigned long long)ran, (unsigned long long)chip->cycles);
+    else
+        printf("ran %llu to cycle %llu\n", (unsigned long long)ran, (unsigned long long)chip->cycles);
+    debug_where(chip);
+}
+
+static void debug_regs(Chip8 *chip){
+    printf("pc 0x%03x  I 0x%03x  sp %d  dt %d  st %d  keys %04x  cycle %llu\n", chip->pc, chip->I,
+           chip->sp & (MAX_SUBROUTINES - 1), chip->delayTimer, chip->soundTimer, chip->keys,
+           (unsigned long long)chip->cycles);
+    printf("v ");
+    for (int i = 0; i < NUM_REGS; i++)
+        printf(" %02x", chip->v[i]);
+    printf("\nstack");
+    for (int i = 1; i <= (chip->sp & (MAX_SUBROUTINES - 1)); i++)
+        printf(" 0x%03x", chip->stack[i]);
+    printf("\n");
+}
+
+static void debug_dis(Chip8 *chip, uint16_t addr, long n){
+    char text[32];
+    for (long i = 0; i < n; i++, addr += 2){
+        int mark = ' ';
+        for (int k = 0; k < DEBUG_POINTS; k++){
+            const DebugPoint *p = &chip->debug->points[k];
+            if (p->kind == POINT_BREAK && p->lo == (addr & chip->mask))
+                mark = 'b';
+        }
+        uint16_t opcode = mem_read(chip, addr) << 8 | mem_read(chip, addr + 1);
+        printf("%s%c 0x%03x: %04x  %s\n", addr == chip->pc ? "=>" : "  ", mark, addr & chip->mask,
+               opcode, chip8_disasm(opcode, chip->variant, text, sizeof(text)));
+    }
+}
+
+static void debug_screen(Chip8 *chip){
+    int w, h;
+    chip8_screen_size(chip, &w, &h);
+    for (int y = 0; y < h; y++){
+        for (int x = 0; x < w; x++){
+            int word = chip->hires ? 2 * y + x / 64 : y;
+            uint64_t bit = 1ULL << (63 - x % 64);
+            int set = (screen_plane(chip, 0)[word] & bit ? 1 : 0) | (screen_plane(chip, 1)[word] & bit ? 2 : 0);
+            putchar(" *+#"[set]);
+        }
+        putchar('\n');
+    }
+}
+
+// split the first word off s, s is left at the rest
+static char *debug_word(char **s){
+    char *w = *s + strspn(*s, " \t"), *end = w + strcspn(w, " \t");
+    *s = end + strspn(end, " \t");
+    if (*end != '\0')
+        *end = '\0';
+    return w;
+}
+
+// cut " if COND" off the end of s
+static char *debug_cond(char *s){
+    char *cond = strstr(s, " if ");
+    if (cond == NULL)
+        return NULL;
+    *cond = '\0';
+    return cond + 4;
+}
+
+static int debug_number(const Chip8 *chip, const char *s, long fallback, long *value){
+    if (*s == '\0'){
+        *value = fallback;
+        return 1;
+    }
+    return chip8_debug_eval(chip, s, value);
+}
+
+int run_debug(Chip8 *chip, FILE *in, uint64_t max_cycles){
+    char line[256];
+    int tty = isatty(fileno(in)), ok = 1;
+    if (!chip8_debug_attach(chip))
+        return 0;
+    debug_where(chip);
+    for (;;){
+        if (tty){
+            printf("(chip8) ");
+            fflush(stdout);
+        }
+        if (fgets(line, sizeof(line), in) == NULL)
+            break;
+        line[strcspn(line, "#\r\n")] = '\0';
+        char *rest = line, *cmd = debug_word(&rest), *cond;
+        long a, b;
+        int id = -1;
+        if (*cmd == '\0')
+            continue;
+        if (strcmp(cmd, "break") == 0 || strcmp(cmd, "b") == 0){
+            cond = debug_cond(rest);
+            id = chip8_debug_eval(chip, rest, &a) ? chip8_debug_break(chip, a, cond) : 0;
+        } else if (strcmp(cmd, "watch") == 0 || strcmp(cmd, "w") == 0){
+            cond = debug_cond(rest);
+            int rw = CHIP8_DEBUG_WRITE;
+            char *what = debug_word(&rest);
+            if (strcmp(what, "r") == 0 || strcmp(what, "w") == 0 || strcmp(what, "rw") == 0){
+                rw = (strchr(what, 'r') ? CHIP8_DEBUG_READ : 0) | (strchr(what, 'w') ? CHIP8_DEBUG_WRITE : 0);
+                what = debug_word(&rest);
+            }
+            id = chip8_debug_watch(chip, what, rw, cond);
+        } else if (strcmp(cmd, "delete") == 0 || strcmp(cmd, "d") == 0){
+            if (!chip8_debug_eval(chip, rest, &a) || !chip8_debug_delete(chip, (int)a)){
+                fprintf(stderr, "Error: no point %s\n", rest);
+                ok = 0;
+            }
+        } else if (strcmp(cmd, "info") == 0){
+            for (int i = 0; i < DEBUG_POINTS; i++){
+                const DebugPoint *p = &chip->debug->points[i];
+                if (p->kind != POINT_NONE)
+                    printf("%d: %s, stopped %llu times\n", i + 1, p->text, (unsigned long long)p->hits);
+            }
+        } else if (strcmp(cmd, "continue") == 0 || strcmp(cmd, "c") == 0){
+            if (debug_number(chip, rest, (long)max_cycles, &a) && a >= 0)
+                debug_run(chip, a);
+            else
+                ok = 0;
+        } else if (strcmp(cmd, "step") == 0 || strcmp(cmd, "s") == 0){
+            if (debug_number(chip, rest, 1, &a) && a > 0)
+                debug_run(chip, a);
+            else
+                ok = 0;
+        } else if (strcmp(cmd, "regs") == 0 || strcmp(cmd, "r") == 0){
+            debug_regs(chip);
+        } else if (strcmp(cmd, "print") == 0 || strcmp(cmd, "p") == 0){
+            if (chip8_debug_eval(chip, rest, &a))
+                printf("%ld (0x%lx)\n", a, (unsigned long)a);
+            else
+                ok = 0;
+        } else if (strcmp(cmd, "x") == 0){
+            char *addr = debug_word(&rest);
+            if (chip8_debug_eval(chip, addr, &a) && debug_number(chip, rest, 16, &b)){
+                for (long i = 0; i < b; i++){
+                    if (i % 16 == 0)
+                        printf("0x%03lx:", (unsigned long)((a + i) & chip->mask));
+                    printf(" %02x%s", mem_read(chip, a + i), i % 16 == 15 || i == b - 1 ? "\n" : "");
+                }
+            } else
+                ok = 0;
+        } else if (strcmp(cmd, "dis") == 0){
+            char *addr = debug_word(&rest);
+            if (debug_number(chip, addr, chip->pc, &a) && debug_number(chip, rest, 8, &b))
+                debug_dis(chip, a, b);
+            else
+                ok = 0;
+        } else if (strcmp(cmd, "screen") == 0){
+            debug_screen(chip);
+        } else if (strcmp(cmd, "quit") == 0 || strcmp(cmd, "q") == 0){
+            break;
+        } else {
+            fprintf(stderr, "Error: no command %s. there's break, watch, delete, info, continue, step, regs, print, x, dis, screen and quit\n", cmd);
+            ok = 0;
+        }
+        if (id == 0)
+            ok = 0;
+        else if (id > 0)
+            printf("%d: %s\n", id, chip->debug->points[id - 1].text);
+    }
+    return ok;
+}
+
+/*
+    batch runner. a manifest has one job per line:
+
+        rom  cycles  [seed]  [input script]      # comment
+
+    jobs are spread over a pool of threads; each thread owns a slice of the job list and
+    takes work from the front of it, and when it runs dry it steals the back half of the
+    busiest looking slice of another thread. every job is its own Chip8, so nothing is
+    shared but the job list. one result line per job is written in manifest order.
+    the rom can also be a snapshot (-w), to fork many runs from one warmed up state; a seed
+    on such a line replaces the one the snapshot was saved with. the input script is a
+    replay recorded with -k, which brings its own seed and speed along.
+*/
+
+enum { EXIT_BUDGET, EXIT_HALT, EXIT_BADOP, EXIT_ERROR };
+static const char *exit_names[] = { "budget", "halt", "badop", "error" };
+
+typedef struct BatchJob {
+    char        rom[256];
+    char        input[256];
+    uint64_t    cycles;
+    uint64_t    seed;
+    int         seeded;             // the line gave a seed
+    // results
+    int         exit;
+    uint64_t    ran;
+    uint64_t    hash;
+    uint16_t    pc, I;
+    uint8_t     v[NUM_REGS];
+} BatchJob;
+
+typedef struct BatchQueue {
+    pthread_mutex_t lock;
+    size_t          lo, hi;             // jobs [lo, hi) still to do
+} BatchQueue;
+
+typedef struct Batch {
+    BatchJob        *jobs;
+    size_t          njobs;
+    BatchQueue      *queues;
+    int             nthreads;
+} Batch;
+
+typedef struct BatchWorker {
+    Batch           *batch;
+    int             id;
+} BatchWorker;
+
+/*
+    1nnn onto itself never changes anything again and an unknown opcode never moves pc, so a
+    job stuck on either is finished early with the same final state it would have had.
+*/
+static int batch_stuck(Chip8 *chip){
+    const Instr *in = code_at(chip, chip->pc);
+    if (in->op == OP_JP && in->nnn == chip->pc)
+        return EXIT_HALT;
+    if (in->op == OP_BAD)
+        return EXIT_BADOP;
+    return EXIT_BUDGET;
+}
+
+static void batch_run_job(BatchJob *job){
+    const uint64_t chunk = 1 << 16;
+    Chip8 *chip = chip8_create(job->seed);
+    Chip8Input *input = NULL;
+    uint64_t seed = job->seed;
+    uint32_t ips = DEFAULT_IPS;
+    job->exit = EXIT_ERROR;
+    if (chip == NULL)
+        return;
+    int ok = job->input[0] == '\0' || (input = chip8_input_open(job->input, &seed, &ips)) != NULL;
+    if (ok && chip8_load_file(chip, job->rom)){
+        if (job->seeded || input != NULL)
+            chip8_seed(chip, job->seed = seed);
+        if (input != NULL)
+            chip8_set_ips(chip, ips);
+        chip8_input_attach(chip, input);
+        job->exit = EXIT_BUDGET;
+        while (job->ran < job->cycles){
+            uint64_t n = job->cycles - job->ran < chunk ? job->cycles - job->ran : chunk;
+            job->ran += chip8_run(chip, n);
+            int stuck = batch_stuck(chip);
+            if (stuck != EXIT_BUDGET){
+                job->exit = stuck;
+                break;
+            }
+        }
+    }
+    job->hash = chip8_screen_hash(chip);
+    job->pc = chip->pc;
+    job->I = chip->I;
+    memcpy(job->v, chip->v, sizeof(job->v));
+    chip8_input_close(input);
+    chip8_destroy(chip);
+}
+
+/* next job for worker `id`: its own queue first, then half of someone else's */
+static int batch_take(Batch *b, int id, size_t *job){
+    BatchQueue *own = &b->queues[id];
+    pthread_mutex_lock(&own->lock);
+    if (own->lo < own->hi){
+        *job = own->lo++;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (int k = 1; k < b->nthreads; k++){
+        BatchQueue *victim = &b->queues[(id + k) % b->nthreads];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->hi - victim->lo;
+        if (left == 0){
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        size_t steal = (left + 1) / 2;
+        size_t from = victim->hi - steal;
+        victim->hi = from;
+        pthread_mutex_unlock(&victim->lock);
+
+        *job = from;
+        pthread_mutex_lock(&own->lock);
+        own->lo = from + 1;
+        own->hi = from + steal;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    return 0;
+}
+
+static void *batch_worker(void *arg){
+    BatchWorker *w = (BatchWorker*)arg;
+    size_t job;
+    while (batch_take(w->batch, w->id, &job))
+        batch_run_job(&w->batch->jobs[job]);
+    return NULL;
+}
+
+static size_t batch_read_manifest(const char *path, BatchJob **out){
+    FILE *f = fopen(path, "r");
+    if (f == NULL){
+        fprintf(stderr, "Error: could not open manifest %s\n", path);
+        return 0;
+    }
+    size_t n = 0, cap = 64;
+    BatchJob *jobs = (BatchJob*)calloc(cap, sizeof(BatchJob));
+    char line[1024];
+    while (jobs != NULL && fgets(line, sizeof(line), f) != NULL){
+        char *hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = '\0';
+        BatchJob job;
+        memset(&job, 0, sizeof(job));
+        unsigned long long cycles = 0, seed = 0;
+        int fields = sscanf(line, "%255s %llu %llu %255s", job.rom, &cycles, &seed, job.input);
+        if (fields <= 0)
+            continue;
+        if (fields < 2){
+            fprintf(stderr, "Error: manifest line needs at least a rom and a cycle count: %s", line);
+            continue;
+        }
+        job.cycles = cycles;
+        job.seed = seed;
+        job.seeded = fields >= 3;
+        if (n == cap){
+            BatchJob *more = (BatchJob*)realloc(jobs, cap * 2 * sizeof(BatchJob));
+            if (more == NULL){
+                free(jobs);
+                jobs = NULL;
+                break;
+            }
+            jobs = more;
+            cap *= 2;
+        }
+        jobs[n++] = job;
+    }
+    fclose(f);
+    if (jobs == NULL){
+        fprintf(stderr, "%s", "Error: allocating batch jobs\n");
+        return 0;
+    }
+    *out = jobs;
+    return n;
+}
+
+int run_batch(const char *manifest, const char *results, int nthreads){
+    Batch b;
+    b.njobs = batch_read_manifest(manifest, &b.jobs);
+    if (b.njobs == 0)
+        return 0;
+    // before running anything, a bad -o shouldn't cost a whole sweep
+    FILE *out = strcmp(results, "-") == 0 ? stdout : fopen(results, "w");
+    if (out == NULL){
+        fprintf(stderr, "Error: could not open results file %s\n", results);
+        free(b.jobs);
+        return 0;
+    }
+    if (nthreads <= 0)
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0)
+        nthreads = 1;
+    if ((size_t)nthreads > b.njobs)
+        nthreads = (int)b.njobs;
+    b.nthreads = nthreads;
+
+    // deal the jobs out in contiguous slices, stealing evens out whatever is left over
+    b.queues = (BatchQueue*)calloc(nthreads, sizeof(BatchQueue));
+    pthread_t *threads = (pthread_t*)calloc(nthreads, sizeof(pthread_t));
+    BatchWorker *workers = (BatchWorker*)calloc(nthreads, sizeof(BatchWorker));
+    int ok = b.queues != NULL && threads != NULL && workers != NULL;
+    if (!ok){
+        fprintf(stderr, "%s", "Error: allocating batch threads\n");
+        nthreads = 0;           // no locks to destroy either
+    }
+    for (int i = 0; i < nthreads; i++){
+        pthread_mutex_init(&b.queues[i].lock, NULL);
+        b.queues[i].lo = b.njobs * i / nthreads;
+        b.queues[i].hi = b.njobs * (i + 1) / nthreads;
+        workers[i].batch = &b;
+        workers[i].id = i;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, batch_worker, &workers[i]);
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    double secs = (now_ns() - start) / 1e9;
+
+    uint64_t total = 0;
+    for (size_t i = 0; ok && i < b.njobs; i++){
+        BatchJob *job = &b.jobs[i];
+        total += job->ran;
+        fprintf(out, "%zu %s exit=%s cycles=%llu seed=%llu hash=%016llx pc=%03x I=%03x v=",
+            i, job->rom, exit_names[job->exit], (unsigned long long)job->ran,
+            (unsigned long long)job->seed, (unsigned long long)job->hash, job->pc, job->I);
+        for (int r = 0; r < NUM_REGS; r++)
+            fprintf(out, "%02x", job->v[r]);
+        fprintf(out, "\n");
+    }
+    if (out != stdout && fclose(out) != 0 && ok){
+        fprintf(stderr, "Error: writing results file %s\n", results);
+        ok = 0;
+    }
+    if (ok)
+        fprintf(stderr, "%zu jobs, %llu cycles on %d threads in %.3f s (%.0f ips)\n",
+            b.njobs, (unsigned long long)total, nthreads, secs, secs > 0 ? total / secs : 0.0);
+
+    for (int i = 0; i < nthreads; i++)
+        pthread_mutex_destroy(&b.queues[i].lock);
+    free(b.queues);
+    free(threads);
+    free(workers);
+    free(b.jobs);
+    return ok;
+}
+
+/*
+    coverage guided fuzzer (-F). a candidate is a rom plus a list of key events, mutated from
+    one already in the corpus, and runs in this process for at most `cycles` instructions on
+    a single chip that is reset in place between runs: its own pages are dropped, the private
+    image under them is patched where the new rom differs (only the ops around those bytes
+    are decoded again) and the registers are set back.
+
+    the measuring rides on the trace hook, so it costs nothing outside the fuzzer. coverage
+    is counted by spot: a 16 byte block of memory and the first nibble of the opcode run in
+    it, 4 K of them. after a run each spot's count goes into a bucket (1, 2, 3, 4-7, 8-15,
+    16-31, 32-127, 128 and up) and the run found something new if a spot landed in a bucket
+    no run had it in before. single addresses or edges between them would be new on nearly
+    every run of random code and flood the corpus. the corpus is capped at FUZZ_CORPUS cases
+    too, a new one then takes the place of one found earlier. every instruction is also
+    checked for what the core lets through silently: a call nested deeper than the
+    stack, a return with nothing on it, Fx33/Fx55 with I too close to the top of memory for
+    what they write, and running an opcode that isn't all inside memory. a candidate that
+    finds new coverage joins the corpus and one that faults is saved as a crash, once per fault
+    and pc. both land in the corpus directory as name.ch8, with its keys as a name.c8r replay
+    when it has any, so `chip8 -p name.c8r -c cycles name.ch8` runs it again.
+*/
+#include <dirent.h>
+
+#define FUZZ_BLOCK      4               // log2 of the bytes of memory a spot covers
+#define FUZZ_MAP_BITS   (12 - FUZZ_BLOCK + 4)   // spots: blocks by opcode nibbles
+#define FUZZ_ROM_SIZE   MAX_ROM_SIZE    // bytes a case can grow to, all of them in memory from 0x200
+_Static_assert(0x200 + FUZZ_ROM_SIZE <= MEMORY_SIZE, "fuzz cases have to fit in a CHIP-8's memory");
+#define FUZZ_SLICE      256             // instructions between checks whether to stop
+#define FUZZ_KEYS       32              // key events a candidate can carry
+#define FUZZ_CORPUS     1024            // cases kept, past that a new one takes the place of an old one
+#define FUZZ_ROUNDS     64              // children of a case run back to back, so most of
+                                        // the image stays as it is from one to the next
+
+enum { FAULT_NONE, FAULT_STACK_OVER, FAULT_STACK_UNDER, FAULT_WRITE, FAULT_FETCH, FAULT_COUNT };
+static const char *fault_names[] = {
+    "none", "stack-overflow", "stack-underflow", "write-past-end", "fetch-past-end"
+};
+
+// the candidate being built and run
+typedef struct FuzzCase {
+    uint8_t         rom[FUZZ_ROM_SIZE];
+    size_t          size;
+    KeyEvent        keys[FUZZ_KEYS];    // in cycle order
+    size_t          nkeys;
+} FuzzCase;
+
+// one kept in the corpus, in a single allocation of just the size it needs
+typedef struct FuzzEntry {
+    KeyEvent        *keys;              // nkeys of them, then the rom
+    uint8_t         *rom;
+    size_t          size, nkeys;
+} FuzzEntry;
+
+typedef struct Fuzz {
+    Chip8           *chip;
+    RomImage        *image;             // the chip's, not in the rom cache and patched per run
+    size_t          image_size;         // rom bytes in it
+    Trace           hook;               // chip->trace while fuzzing
+    Chip8Input      input;              // the candidate's keys
+    uint64_t        seed, rng;
+    uint64_t        cycles;             // per run
+    size_t          fresh;              // spots this run took a count of times no run did before
+    uint32_t        ntouched;
+    uint16_t        touched[1 << FUZZ_MAP_BITS]; // the spots this run has counts for
+    uint8_t         hits[1 << FUZZ_MAP_BITS];    // how often this run took each spot, up to 255
+    int             fault;
+    uint16_t        fault_pc;
+    uint8_t         map[1 << FUZZ_MAP_BITS];     // bit b: some run took the spot a bucket b count of times
+    uint8_t         crashed[FAULT_COUNT][MEMORY_SIZE / 8];  // (fault, pc) already saved
+    FuzzEntry       *corpus;
+    FuzzCase        next;
+    size_t          count, cap;
+    size_t          seeds;              // the first cases, the ones the session started from stay
+    size_t          spots, crashes;
+    const char      *dir;
+} Fuzz;
+
+static uint64_t fuzz_rand(Fuzz *f){
+    f->rng ^= f->rng >> 12;
+    f->rng ^= f->rng << 25;
+    f->rng ^= f->rng >> 27;
+    return f->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static void fuzz_record(Chip8 *chip, uint16_t pc, const Instr *in){
+    Fuzz *f = chip->trace->fuzz;
+    uint16_t spot = ((pc & MEM_MASK) >> FUZZ_BLOCK) << 4 | mem_read(chip, pc) >> 4;
+    if (f->hits[spot] == 0)
+        f->touched[f->ntouched++] = spot;
+    if (f->hits[spot] != 255)
+        f->hits[spot]++;
+    // it already ran, so sp and I are as it left them
+    int fault = FAULT_NONE;
+    switch (in->op){
+        case OP_CALL:   if (chip->sp > MAX_SUBROUTINES) fault = FAULT_STACK_OVER; break;
+        case OP_RET:    if (chip->sp > MAX_SUBROUTINES) fault = FAULT_STACK_UNDER; break;
+        case OP_LD_B:   if (chip->I > MEMORY_SIZE - 3) fault = FAULT_WRITE; break;
+        case OP_LD_MEM: if (chip->I + in->x > MEMORY_SIZE - 1) fault = FAULT_WRITE; break;
+    }
+    if (pc > MEMORY_SIZE - 2)
+        fault = FAULT_FETCH;
+    if (fault != FAULT_NONE && f->fault == FAULT_NONE){
+        f->fault = fault;
+        f->fault_pc = pc & MEM_MASK;
+    }
+}
+
+/* reset the chip to a fresh start on c */
+static void fuzz_load(Fuzz *f, const FuzzCase *c){
+    RomImage *img = f->image;
+    uint8_t *mem = img->memory + 0x200;
+    size_t n = c->size > f->image_size ? c->size : f->image_size;
+    Chip8 view;
+    view.ext = NULL;            // CHIP-8 only, its page tables are the Chip8's own
+    image_view(&view, img);
+    // an op depends on the 2 bytes it starts on and, for a wait loop head, the 4 after, so a
+    // changed byte at a dirties the ops at a - 5 .. a. those ranges overlap, gather them into
+    // lo .. hi and decode a run once nothing later can touch the bytes it reads
+    int lo = 0, hi = -1;
+    for (size_t block = 0; block < n; block += 64){
+        size_t end = block + 64 < n ? block + 64 : n;
+        if (end <= c->size && memcmp(mem + block, c->rom + block, end - block) == 0)
+            continue;
+        for (size_t i = block; i < end; i++){
+            uint8_t b = i < c->size ? c->rom[i] : 0;
+            if (mem[i] == b)
+                continue;
+            mem[i] = b;
+            int a = 0x200 + (int)i;
+            if (a - 5 > hi + 1){
+                for (int k = lo; k <= hi; k++)
+                    img->decoded[k] = decode_at(&view, k);
+                lo = a - 5;
+            }
+            hi = a;
+        }
+    }
+    for (int k = lo; k <= hi; k++)
+        img->decoded[k] = decode_at(&view, k);
+    f->image_size = img->size = c->size;
+
+    Chip8 *chip = f->chip;
+    mem_revert(chip);
+    chip->pc = 0x200;
+    chip->I = chip->sp = chip->opcode = 0;
+    memset(chip->stack, 0, sizeof(chip->stack));
+    memset(chip->v, 0, sizeof(chip->v));
+    chip->delayTimer = chip->soundTimer = 0;
+    chip->cycles = 0;
+    chip8_set_ips(chip, DEFAULT_IPS);
+    chip8_seed(chip, f->seed);
+    chip->keys = 0;
+    clear_screen(chip);
+    chip->screen_dirty = 0;
+    chip->rom_size = c->size;
+    f->input.events = (KeyEvent*)c->keys;
+    f->input.count = c->nkeys;
+    chip8_input_attach(chip, &f->input);
+    f->fresh = 0;
+    f->fault = FAULT_NONE;
+}
+
+// which bucket a run's count of a spot is in
+static int fuzz_bucket(uint8_t hits){
+    return hits <= 3 ? hits - 1 : hits < 8 ? 3 : hits < 16 ? 4 : hits < 32 ? 5 : hits < 128 ? 6 : 7;
+}
+
+static void fuzz_exec(Fuzz *f, const FuzzCase *c){
+    fuzz_load(f, c);
+    uint64_t ran = 0;
+    while (ran < f->cycles && f->fault == FAULT_NONE){
+        uint64_t n = f->cycles - ran < FUZZ_SLICE ? f->cycles - ran : FUZZ_SLICE;
+        ran += chip8_run(f->chip, n);
+        if (batch_stuck(f->chip) != EXIT_BUDGET)
+            break;                      // nothing more to find down here
+    }
+    for (uint32_t i = 0; i < f->ntouched; i++){
+        uint16_t spot = f->touched[i];
+        uint8_t bit = 1 << fuzz_bucket(f->hits[spot]);
+        if (f->map[spot] == 0)
+            f->spots++;
+        if (!(f->map[spot] & bit)){
+            f->map[spot] |= bit;
+            f->fresh++;
+        }
+        f->hits[spot] = 0;
+    }
+    f->ntouched = 0;
+}
+
+static void fuzz_copy(FuzzCase *dst, const FuzzEntry *src){
+    memcpy(dst->rom, src->rom, src->size);
+    dst->size = src->size;
+    memcpy(dst->keys, src->keys, src->nkeys * sizeof(KeyEvent));
+    dst->nkeys = src->nkeys;
+}
+
+static void fuzz_mutate(Fuzz *f, FuzzCase *c){
+    for (int rounds = 1 + fuzz_rand(f) % 4; rounds > 0; rounds--){
+        uint64_t r = fuzz_rand(f);
+        size_t at = c->size ? (r >> 8) % c->size : 0;
+        int what = r % 8;
+        if (c->size < 2 && what < 5)
+            what = 3;                   // nothing to change yet, make it bigger
+        switch (what){
+            case 0: c->rom[at] ^= 1 << (r >> 40) % 8; break;
+            case 1: c->rom[at] = r >> 40; break;
+            case 2:                     // a whole instruction
+                at &= ~(size_t)1;
+                c->rom[at] = r >> 40;
+                if (at + 1 < c->size)
+                    c->rom[at + 1] = r >> 48;
+                break;
+            case 3:                     // an instruction more, or one less
+                if ((r >> 56 & 1) && c->size >= 4){
+                    c->size -= 2;
+                } else if (c->size + 2 <= FUZZ_ROM_SIZE){
+                    c->rom[c->size++] = r >> 40;
+                    c->rom[c->size++] = r >> 48;
+                }
+                break;
+            case 4: {                   // some bytes of another case, at the same place
+                const FuzzEntry *o = &f->corpus[(r >> 40) % f->count];
+                size_t len = 1 + (r >> 24) % 16;
+                for (size_t i = at; i < at + len && i < c->size && i < o->size; i++)
+                    c->rom[i] = o->rom[i];
+                break;
+            }
+            case 5:                     // a key event somewhere in the run
+                if (c->nkeys < FUZZ_KEYS){
+                    KeyEvent ev = { (r >> 16) % f->cycles, (uint8_t)((r >> 8) & 0x8F) };
+                    size_t i = c->nkeys++;
+                    for (; i > 0 && c->keys[i - 1].cycle > ev.cycle; i--)
+                        c->keys[i] = c->keys[i - 1];
+                    c->keys[i] = ev;
+                }
+                break;
+            case 6:
+                if (c->nkeys > 0){
+                    size_t i = (r >> 16) % c->nkeys;
+                    memmove(&c->keys[i], &c->keys[i + 1], (c->nkeys - i - 1) * sizeof(KeyEvent));
+                    c->nkeys--;
+                }
+                break;
+            case 7:
+                if (c->nkeys > 0)
+                    c->keys[(r >> 16) % c->nkeys].key ^= 0x80;
+                break;
+        }
+    }
+}
+
+/* write c out as dir/name.ch8, plus dir/name.c8r when it has keys */
+static void fuzz_save(Fuzz *f, const FuzzCase *c, const char *name){
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.ch8", f->dir, name);
+    FILE *out = fopen(path, "wb");
+    if (out == NULL || fwrite(c->rom, 1, c->size, out) != c->size)
+        fprintf(stderr, "Error: could not write %s\n", path);
+    if (out != NULL)
+        fclose(out);
+    snprintf(path, sizeof(path), "%s/%s.c8r", f->dir, name);
+    if (c->nkeys == 0){
+        remove(path);           // left by a case this one took the place of
+        return;
+    }
+    Chip8 *chip = f->chip;
+    Chip8Input *in = chip8_input_record(path, f->seed, chip);
+    if (in == NULL)
+        return;
+    for (size_t i = 0; i < c->nkeys; i++){
+        input_put_varint(in->log, c->keys[i].cycle - in->last);
+        fputc(c->keys[i].key, in->log);
+        in->last = c->keys[i].cycle;
+    }
+    chip8_input_close(in);
+}
+
+/* put c in the corpus at slot, which is either taken or the next one */
+static int fuzz_put(Fuzz *f, const FuzzCase *c, size_t slot){
+    if (slot < f->count){
+        free(f->corpus[slot].keys);
+        f->corpus[slot].keys = NULL;
+    } else if (f->count == f->cap){
+        size_t cap = f->cap ? f->cap * 2 : 64;
+        FuzzEntry *corpus = (FuzzEntry*)realloc(f->corpus, cap * sizeof(FuzzEntry));
+        if (corpus == NULL)
+            return 0;
+        f->corpus = corpus;
+        f->cap = cap;
+    }
+    FuzzEntry *e = &f->corpus[slot];
+    if ((e->keys = (KeyEvent*)malloc(c->nkeys * sizeof(KeyEvent) + c->size + 1)) == NULL){
+        if (slot < f->count)
+            *e = f->corpus[--f->count];     // don't leave a hole
+        return 0;
+    }
+    e->rom = (uint8_t*)(e->keys + c->nkeys);
+    e->size = c->size;
+    e->nkeys = c->nkeys;
+    memcpy(e->keys, c->keys, c->nkeys * sizeof(KeyEvent));
+    memcpy(e->rom, c->rom, c->size);
+    if (slot == f->count)
+        f->count++;
+    return 1;
+}
+
+static int fuzz_add(Fuzz *f, const FuzzCase *c){
+    return fuzz_put(f, c, f->count);
+}
+
+/* run c and keep it if it found something. returns 1 if it did */
+static int fuzz_try(Fuzz *f, const FuzzCase *c){
+    char name[64];
+    fuzz_exec(f, c);
+    if (f->fault != FAULT_NONE){
+        uint8_t *seen = &f->crashed[f->fault][f->fault_pc >> 3];
+        if (*seen >> (f->fault_pc & 7) & 1)
+            return 0;
+        *seen |= 1 << (f->fault_pc & 7);
+        snprintf(name, sizeof(name), "crash-%s-%03x", fault_names[f->fault], f->fault_pc);
+        fuzz_save(f, c, name);
+        f->crashes++;
+        return 1;
+    }
+    if (f->fresh == 0)
+        return 0;
+    size_t slot = f->count;
+    if (f->count >= FUZZ_CORPUS && f->count > f->seeds)
+        slot = f->seeds + fuzz_rand(f) % (f->count - f->seeds);
+    if (!fuzz_put(f, c, slot))
+        return 0;
+    snprintf(name, sizeof(name), "cov-%04zu", slot);
+    fuzz_save(f, c, name);
+    return 1;
+}
+
+/* a rom (and its replay, if there is one next to it) as a case. 0 if it won't do */
+static int fuzz_read(Fuzz *f, const char *path, FuzzCase *c){
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
+        return 0;
+    c->size = fread(c->rom, 1, FUZZ_ROM_SIZE, in);
+    int ok = fgetc(in) == EOF;          // too big for a rom
+    fclose(in);
+    c->nkeys = 0;
+    size_t len = strlen(path);
+    if (!ok || len < 4 || len >= 4096)
+        return ok;
+    char replay[4096];
+    memcpy(replay, path, len - 4);
+    strcpy(replay + len - 4, ".c8r");
+    uint64_t seed;
+    uint32_t ips;
+    if (access(replay, R_OK) != 0)
+        return 1;
+    Chip8Input *keys = chip8_input_open(replay, &seed, &ips);
+    if (keys == NULL)
+        return 1;
+    for (size_t i = 0; i < keys->count && c->nkeys < FUZZ_KEYS; i++)
+        if (keys->events[i].cycle < f->cycles)
+            c->keys[c->nkeys++] = keys->events[i];
+    chip8_input_close(keys);
+    return 1;
+}
+
+int run_fuzz(const char *rom, const char *dir, uint64_t cycles, double seconds, uint64_t seed){
+    Fuzz *f = (Fuzz*)calloc(1, sizeof(Fuzz));
+    if (f == NULL || (f->chip = chip8_create(seed)) == NULL
+        || (f->image = rom_image_build(0, (const uint8_t*)"", 0, CHIP8_VARIANT_CHIP8)) == NULL){
+        fprintf(stderr, "%s", "Error: allocating the fuzzer\n");
+        if (f != NULL)
+            chip8_destroy(f->chip);
+        free(f);
+        return 0;
+    }
+    mkdir(dir, 0777);                   // fine if it's there already
+    f->dir = dir;
+    f->cycles = cycles;
+    f->seed = seed;
+    f->rng = seed * 0x9E3779B97F4A7C15ULL | 1;
+    mem_attach(f->chip, f->image);
+    f->hook.fuzz = f;
+    f->chip->trace = &f->hook;
+
+    // the corpus starts as the rom, whatever an earlier session left in dir, or nothing at all
+    FuzzCase *c = &f->next;
+    c->size = c->nkeys = 0;
+    if (rom != NULL && !fuzz_read(f, rom, c)){
+        fprintf(stderr, "Error: could not read %s as a rom\n", rom);
+        f->chip->trace = NULL;
+        chip8_destroy(f->chip);
+        free(f);
+        return 0;
+    }
+    fuzz_add(f, c);
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d != NULL && (e = readdir(d)) != NULL){
+        size_t len = strlen(e->d_name);
+        char path[4096];
+        if (len < 4 || strcmp(e->d_name + len - 4, ".ch8") != 0 || strncmp(e->d_name, "crash-", 6) == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (fuzz_read(f, path, c))
+            fuzz_add(f, c);
+    }
+    if (d != NULL)
+        closedir(d);
+    size_t seeds = f->seeds = f->count;
+    for (size_t i = 0; i < seeds; i++){
+        fuzz_copy(c, &f->corpus[i]);
+        fuzz_exec(f, c);
+    }
+
+    uint64_t start = now_ns(), execs = 0, report = start, reported = 0;
+    double elapsed = 0;
+    while (elapsed < seconds){
+        size_t parent = fuzz_rand(f) % f->count;
+        for (int i = 0; i < FUZZ_ROUNDS; i++){
+            fuzz_copy(c, &f->corpus[parent]);
+            fuzz_mutate(f, c);
+            fuzz_try(f, c);
+        }
+        execs += FUZZ_ROUNDS;
+        uint64_t now = now_ns();
+        elapsed = (now - start) / 1e9;
+        if (now - report >= 1000000000ULL){
+            fprintf(stderr, "%llu execs, %.0f/s, corpus %zu, spots %zu, crashes %zu\n",
+                (unsigned long long)execs, (execs - reported) * 1e9 / (now - report),
+                f->count, f->spots, f->crashes);
+            report = now;
+            reported = execs;
+        }
+    }
+
+    printf("corpus:     %s (%zu from the start)\n", dir, seeds);
+    printf("cycles:     %llu per run\n", (unsigned long long)cycles);
+    printf("execs:      %llu in %.3f s\n", (unsigned long long)execs, elapsed);
+    printf("exec/s:     %.0f\n", elapsed > 0 ? execs / elapsed : 0.0);
+    printf("cases:      %zu\n", f->count);
+    printf("spots:      %zu\n", f->spots);
+    printf("crashes:    %zu\n", f->crashes);
+    f->chip->trace = NULL;
+    chip8_destroy(f->chip);
+    for (size_t i = 0; i < f->count; i++)
+        free(f->corpus[i].keys);
+    free(f->corpus);
+    free(f);
+    return 1;
+}
+
+static int same_memory(const Chip8 *a, const Chip8 *b){
+    if (a->pages != b->pages)
+        return 0;
+    for (int p = 0; p < a->pages; p++)
+        if (MEM_TAB(a, a->mask)[p] != MEM_TAB(b, b->mask)[p]
+            && memcmp(MEM_TAB(a, a->mask)[p], MEM_TAB(b, b->mask)[p], MEM_PAGE_SIZE) != 0)
+            return 0;
+    return 1;
+}
+
+int same_state(Chip8 *a, Chip8 *b){
+    return a->pc == b->pc && a->I == b->I && a->sp == b->sp
+        && a->delayTimer == b->delayTimer && a->soundTimer == b->soundTimer
+        && a->cycles == b->cycles && a->rng == b->rng && a->keys == b->keys
+        && !memcmp(a->v, b->v, sizeof(a->v))
+        && !memcmp(a->stack, b->stack, sizeof(a->stack))
+        && a->hires == b->hires && a->planes == b->planes
+        && !memcmp(a->flags, b->flags, sizeof(a->flags))
+        && same_memory(a, b)
+        && !memcmp(a->screen, b->screen, sizeof(a->screen))
+        && (a->ext == NULL) == (b->ext == NULL)
+        && (a->ext == NULL || !memcmp(a->ext->screen, b->ext->screen, sizeof(a->ext->screen)));
+}
+
+/*
+    differential tests: run the same rom through an engine (the jit, or the interpreter with
+    superinstructions) and one instruction at a time through interpreter(), in uneven chunks
+    so budgets end in the middle of whatever the engine runs in one go, and compare the whole
+    machine after each chunk.
+*/
+static int diff_check(Chip8 *chip, Chip8 *ref, const char *path, uint64_t max_cycles,
+                      uint64_t (*run)(Chip8 *chip, uint64_t cycles), const char *what){
+    uint64_t cycles = 0;
+    uint32_t chunk = 1;
+    while(cycles < max_cycles){
+        chunk = (chunk * 1103515245 + 12345) & 0x7FFFFFFF;
+        uint64_t n = 1 + chunk % 997;
+        if (n > max_cycles - cycles)
+            n = max_cycles - cycles;
+        run(chip, n);
+        for(uint64_t i = 0; i < n; i++){
+            interpreter(ref);
+        }
+        cycles += n;
+        if(!same_state(chip, ref)){
+            printf("%s: %s diverged from the interpreter by cycle %llu (pc 0x%03x vs 0x%03x)\n",
+                path, what, (unsigned long long)cycles, chip->pc, ref->pc);
+            return 0;
+        }
+    }
+    printf("%s: %s matches the interpreter for %llu cycles\n", path, what, (unsigned long long)cycles);
+    return 1;
+}
+
+/*
+    then load both with the rom with every 6xkk and 7xkk constant changed, over the code
+    compiled from the original, and check that again: none of the old regions may run
+*/
+int jit_check(Chip8 *jit, Chip8 *ref, const char *path, uint64_t max_cycles){
+    if (!diff_check(jit, ref, path, max_cycles, chip8_run_jit, "jit"))
+        return 0;
+    size_t size = ref->rom_size;
+    uint8_t *rom = (uint8_t*)malloc(size + 1);
+    if (rom == NULL)
+        return 0;
+    memcpy(rom, ref->image->memory + 0x200, size);
+    for (size_t i = 0; i + 1 < size; i += 2)
+        if (rom[i] >> 4 == 0x6 || rom[i] >> 4 == 0x7)
+            rom[i + 1] ^= 0x5A;
+    int ok = chip8_load_rom(jit, rom, size) && chip8_load_rom(ref, rom, size)
+        && diff_check(jit, ref, path, max_cycles, chip8_run_jit, "jit after a reload");
+    free(rom);
+    return ok;
+}
+
+/* fused has had chip8_fuse() or chip8_fuse_load(), ref is the same rom without */
+int fuse_check(Chip8 *fused, Chip8 *ref, const char *path, uint64_t max_cycles){
+    return diff_check(fused, ref, path, max_cycles, chip8_run, "fused");
+}
+
+/*
+    -R: check of snapshots and rewind. run a frame at a time keeping history, go `back` frames
+    back, run the same frames again and compare with the state the first run ended in.
+*/
+int rewind_check(Chip8 *chip, const char *path, uint64_t max_cycles, size_t back){
+    uint8_t end[SNAP_SIZE], again[SNAP_SIZE];
+    if (chip->variant != CHIP8_VARIANT_CHIP8){
+        fprintf(stderr, "Error: %s isn't a CHIP-8 rom, rewind is CHIP-8 only\n", path);
+        return 0;
+    }
+    Chip8Rewind *r = chip8_rewind_create((double)back / TIMER_HZ);
+    if (r == NULL){
+        fprintf(stderr, "%s", "Error: allocating rewind history\n");
+        return 0;
+    }
+    uint64_t ran = 0, frames = 0;
+    chip8_rewind_push(r, chip);
+    while (ran < max_cycles){
+        ran += chip8_run(chip, until_tick(chip));
+        chip8_rewind_push(r, chip);
+        frames++;
+    }
+    chip8_save(chip, end);
+    if (back > r->count - 1)
+        back = r->count - 1;
+
+    printf("rom:        %s\n", path);
+    printf("frames:     %llu (%.1f s emulated)\n", (unsigned long long)frames, (double)frames / TIMER_HZ);
+    printf("history:    %zu frames in %zu bytes, %.0f bytes per second\n",
+           r->count, r->bytes, r->count > 1 ? (double)r->bytes * TIMER_HZ / r->count : 0.0);
+
+    // the second time round history goes on from the frames the first replay pushed
+    int ok = 1;
+    for (int round = 0; ok && round < 2; round++){
+        uint64_t t0 = now_ns();
+        ok = chip8_rewind_restore(r, chip, back);
+        uint64_t restore_ns = now_ns() - t0;
+        printf("restore:    %zu frames back in %.1f us\n", back, restore_ns / 1e3);
+        for (size_t i = 0; ok && i < back; i++){
+            chip8_run(chip, until_tick(chip));
+            chip8_rewind_push(r, chip);
+        }
+        chip8_save(chip, again);
+        ok = ok && memcmp(end, again, SNAP_SIZE) == 0;
+    }
+    printf("%s: %s\n", path, ok ? "state after replaying matches" : "rewind diverged from the first run");
+    chip8_rewind_destroy(r);
+    return ok;
+}
+
+/*
+    lockstep ("wide") engine: up to WIDE_LANES instances of the same rom, with V0-VF, I and pc
+    kept structure-of-arrays so one decoded opcode runs on every lane at once with vector ops
+    (gcc/clang vector extensions, SSE2 by default, AVX2 with -mavx2). each step picks the
+    lowest pc among lanes that still have budget and runs that instruction on every lane
+    sitting at the same pc; lanes that went elsewhere on a skip or jump are masked off and
+    catch up when the lowest pc reaches them again. ops that touch memory, the stack or the
+    screen run per lane through the scalar core, on the lane's own Chip8, so every lane ends
+    up exactly where the scalar interpreter would.
+*/
+#define WIDE_LANES 32
+
+typedef uint8_t  wv8  __attribute__((vector_size(WIDE_LANES)));
+typedef int8_t   wvs8 __attribute__((vector_size(WIDE_LANES)));
+typedef uint16_t wv16 __attribute__((vector_size(WIDE_LANES * 2)));
+typedef int16_t  wvs16 __attribute__((vector_size(WIDE_LANES * 2)));
+typedef uint32_t wv32 __attribute__((vector_size(WIDE_LANES * 4)));
+typedef int32_t  wvs32 __attribute__((vector_size(WIDE_LANES * 4)));
+
+typedef struct Wide {
+    int         lanes;
+    wv8         v[NUM_REGS];            // v[r][lane]
+    wv16        I, pc;
+    wv32        left;                   // instructions each lane still has to run
+    Chip8       *chip[WIDE_LANES];      // memory, stack, screen: everything not in vectors
+    uint8_t     dirty[MEMORY_SIZE];     // some lane wrote here, lanes may disagree on the code
+    uint64_t    steps, lane_steps;      // vector steps taken, lane instructions run
+} Wide;
+
+#define BLEND(old, new, m) (((old) & ~(m)) | ((new) & (m)))
+
+static const uint8_t all_code[MEMORY_SIZE] = { [0 ... MEMORY_SIZE - 1] = 1 };
+
+static void wide_code_write(Chip8 *chip, uint16_t addr){
+    ((Wide*)chip->code_ctx)->dirty[addr] = 1;
+}
+
+/* lane registers -> their Chip8 and back, around anything run by the scalar core */
+static void wide_to_chip(Wide *w, int l){
+    Chip8 *chip = w->chip[l];
+    for (int r = 0; r < NUM_REGS; r++)
+        chip->v[r] = w->v[r][l];
+    chip->I = w->I[l];
+    chip->pc = w->pc[l];
+}
+
+static void wide_from_chip(Wide *w, int l){
+    Chip8 *chip = w->chip[l];
+    for (int r = 0; r < NUM_REGS; r++)
+        w->v[r][l] = chip->v[r];
+    w->I[l] = chip->I;
+    w->pc[l] = chip->pc;
+}
+
+/* pull every lane's registers in, after the caller changed the lane Chip8s directly */
+void wide_sync_in(Wide *w){
+    for (int l = 0; l < w->lanes; l++)
+        wide_from_chip(w, l);
+}
+
+/* push lane registers out so each w->chip[l] is a complete, normal Chip8 again */
+void wide_sync_out(Wide *w){
+    for (int l = 0; l < w->lanes; l++)
+        wide_to_chip(w, l);
+}
+
+void wide_destroy(Wide *w);
+
+/* lane l is seeded with seed + l */
+Wide *wide_create(char *path, int lanes, uint64_t seed){
+    if (lanes < 1 || lanes > WIDE_LANES)
+        return NULL;
+    Wide *w = (Wide*)calloc(1, sizeof(Wide));
+    if (w == NULL)
+        return NULL;
+    w->lanes = lanes;
+    for (int l = 0; l < lanes; l++){
+        w->chip[l] = chip8_create(seed + l);
+        if (w->chip[l] == NULL || !chip8_load_file(w->chip[l], path)
+            || w->chip[l]->variant != CHIP8_VARIANT_CHIP8){
+            w->lanes = l + 1;
+            wide_destroy(w);
+            return NULL;
+        }
+        w->chip[l]->code_map = all_code;
+        w->chip[l]->code_write = wide_code_write;
+        w->chip[l]->code_ctx = w;
+    }
+    wide_sync_in(w);
+    return w;
+}
+
+void wide_destroy(Wide *w){
+    for (int l = 0; l < w->lanes; l++)
+        chip8_destroy(w->chip[l]);
+    free(w);
+}
+
+/* run the instruction at pc on lane l through the scalar core */
+static void wide_scalar(Wide *w, int l){
+    wide_to_chip(w, l);
+    run_core(w->chip[l], 1);
+    wide_from_chip(w, l);
+}
+
+/*
+    run the instruction `in` on every lane in the mask `same`, or on all of them when it is
+    NULL. returns 1 if it is one that can send lanes at the same pc different ways.
+*/
+static inline __attribute__((always_inline)) int wide_exec(Wide *w, const Instr *in, const wvs16 *same){
+    const wv8 m = same ? (wv8)__builtin_convertvector(*same, wvs8) : (wv8){} + 0xFF;
+    const wv16 m16 = same ? (wv16)*same : (wv16){} + 0xFFFF;
+    uint8_t x = in->x, y = in->y, kk = in->nnn & 0xFF;
+    wv8 a = w->v[x], b = w->v[y];
+    wv16 next = w->pc + 2;
+    int branch = 0;
+    switch (in->op){
+        case OP_JP:     next = (wv16){} + in->nnn; break;
+        case OP_SE_KK:  next += (wv16)__builtin_convertvector((wvs8)(a == kk), wvs16) & 2; branch = 1; break;
+        case OP_SNE_KK: next += (wv16)__builtin_convertvector((wvs8)(a != kk), wvs16) & 2; branch = 1; break;
+        case OP_SE_XY:  next += (wv16)__builtin_convertvector((wvs8)(a == b), wvs16) & 2; branch = 1; break;
+        case OP_SNE_XY: next += (wv16)__builtin_convertvector((wvs8)(a != b), wvs16) & 2; branch = 1; break;
+        case OP_LD_KK:  w->v[x] = BLEND(a, (wv8){} + kk, m); break;
+        case OP_ADD_KK: w->v[x] = BLEND(a, a + kk, m); break;
+        case OP_LD_XY:  w->v[x] = BLEND(a, b, m); break;
+        case OP_OR:     w->v[x] = BLEND(a, a | b, m); break;
+        case OP_AND:    w->v[x] = BLEND(a, a & b, m); break;
+        case OP_XOR:    w->v[x] = BLEND(a, a ^ b, m); break;
+        case OP_ADD_XY: {
+            // same order as the scalar handler: VF from the old values, then Vx
+            wv8 sum = a + b;
+            w->v[0xF] = BLEND(w->v[0xF], (wv8)(sum < a) & 1, m);
+            w->v[x] = BLEND(w->v[x], sum, m);
+            break;
+        }
+        case OP_SUB:
+            w->v[0xF] = BLEND(w->v[0xF], (wv8)(a >= b) & 1, m);
+            w->v[x] = BLEND(w->v[x], w->v[x] - w->v[y], m);
+            break;
+        case OP_SUBN:
+            w->v[0xF] = BLEND(w->v[0xF], (wv8)(b >= a) & 1, m);
+            w->v[x] = BLEND(w->v[x], w->v[y] - w->v[x], m);
+            break;
+        case OP_SHR:
+            w->v[0xF] = BLEND(w->v[0xF], a & 1, m);
+            w->v[x] = BLEND(w->v[x], w->v[x] >> 1, m);
+            break;
+        case OP_SHL:
+            w->v[0xF] = BLEND(w->v[0xF], a >> 7, m);
+            w->v[x] = BLEND(w->v[x], w->v[x] << 1, m);
+            break;
+        case OP_LD_I:   w->I = BLEND(w->I, (wv16){} + in->nnn, m16); break;
+        case OP_ADD_I:  w->I = BLEND(w->I, w->I + __builtin_convertvector(a, wv16), m16); break;
+        case OP_LD_F:   w->I = BLEND(w->I, __builtin_convertvector(a, wv16) * 5, m16); break;
+        default:
+            // stack, memory, screen, rng: lane by lane through the scalar core
+            for (int l = 0; l < w->lanes; l++)
+                if (same == NULL || (*same)[l])
+                    wide_scalar(w, l);
+            return 1;
+    }
+    w->pc = BLEND(w->pc, next, m16);
+    return branch;
+}
+
+static const Instr *wide_fetch(Wide *w, int leader){
+    Chip8 *lc = w->chip[leader];
+    uint16_t pc = w->pc[leader] & MEM_MASK;
+    Instr *in = code_at(lc, pc);
+    if (in->op == OP_DECODE)
+        *in = decode_at(lc, pc);    // on a page of lc's own, see mem_write()
+    return in;
+}
+
+static int wide_converged(Wide *w){
+    for (int l = 1; l < w->lanes; l++)
+        if (w->pc[l] != w->pc[0] || w->left[l] == 0)
+            return 0;
+    return w->left[0] != 0;
+}
+
+// the cpu part of wide_run(): every lane runs `cycles` instructions, the clocks don't move
+static uint64_t wide_core(Wide *w, uint64_t cycles){
+    uint64_t steps = 0;
+    const wv32 one = (wv32){} + 1;
+    for (int l = 0; l < w->lanes; l++)
+        w->left[l] = cycles > UINT32_MAX ? UINT32_MAX : (uint32_t)cycles;
+
+    for (;;){
+        /*
+            fast path: every lane at the same pc with budget left. no masks to build and no
+            leader to look for until an instruction that can split them, or a patched byte
+            that lanes may disagree on.
+        */
+        if (wide_converged(w)){
+            uint32_t k = w->left[0], done = 0;
+            for (int l = 1; l < w->lanes; l++)
+                if (w->left[l] < k)
+                    k = w->left[l];
+            while (done < k){
+                uint16_t pc = w->pc[0] & MEM_MASK;
+                if (w->dirty[pc] || w->dirty[(pc + 1) & MEM_MASK])
+                    break;
+                done++;
+                if (wide_exec(w, wide_fetch(w, 0), NULL) && !wide_converged(w))
+                    break;
+            }
+            w->left -= (wv32){} + done;
+            steps += done;
+            if (done != 0)
+                continue;
+        }
+
+        // leader: lowest pc among lanes with budget left
+        int leader = -1;
+        for (int l = 0; l < w->lanes; l++)
+            if (w->left[l] != 0 && (leader < 0 || w->pc[l] < w->pc[leader]))
+                leader = l;
+        if (leader < 0)
+            break;
+        uint16_t pc = w->pc[leader];
+        const Instr *in = wide_fetch(w, leader);
+        Chip8 *lc = w->chip[leader];
+
+        // lanes at the same pc that (still) have the same instruction there
+        wvs16 same = (w->pc == (wv16){} + pc) & (wvs16)__builtin_convertvector(w->left != 0, wvs16);
+        if (w->dirty[pc & MEM_MASK] || w->dirty[(pc + 1) & MEM_MASK]){
+            for (int l = 0; l < w->lanes; l++){
+                if (same[l] && l != leader
+                    && mem_op(w->chip[l], pc) != mem_op(lc, pc))
+                    same[l] = 0;
+            }
+        }
+        wide_exec(w, in, &same);
+        w->left -= (wv32)__builtin_convertvector(same, wvs32) & one;
+        steps++;
+    }
+    w->steps += steps;
+    w->lane_steps += cycles * w->lanes;
+    return steps;
+}
+
+/*
+    every lane runs `cycles` more instructions. returns the number of vector steps it took.
+    lanes always run the same number of instructions, so their clocks stay equal and the
+    timers of all of them tick on the same boundaries.
+*/
+uint64_t wide_run(Wide *w, uint64_t cycles){
+    uint64_t steps = 0;
+    while (cycles != 0){
+        uint64_t n = until_tick(w->chip[0]);
+        if (n > cycles) n = cycles;
+        steps += wide_core(w, n);
+        for (int l = 0; l < w->lanes; l++)
+            clock_advance(w->chip[l], n);
+        cycles -= n;
+    }
+    return steps;
+}
+
+/*
+    -W: run `lanes` copies of the rom in lockstep, lane l starting with V0-VF scrambled by l so
+    they take different paths, then replay every lane through the scalar core and compare.
+*/
+int run_wide(char *path, int lanes, uint64_t cycles, uint64_t seed){
+    if (variant_of(path) != CHIP8_VARIANT_CHIP8){
+        fprintf(stderr, "Error: %s isn't a CHIP-8 rom, the lanes are CHIP-8 only\n", path);
+        return 0;
+    }
+    Wide *w = wide_create(path, lanes, seed);
+    if (w == NULL){
+        fprintf(stderr, "Error: could not set up %d lanes of %s\n", lanes, path);
+        return 0;
+    }
+    for (int l = 1; l < lanes; l++)
+        for (int r = 0; r < NUM_REGS; r++)
+            w->chip[l]->v[r] = (uint8_t)((l * 0x9E3779B1u) >> (r + 8));
+    Chip8 *start = (Chip8*)malloc(sizeof(Chip8) * lanes);
+    for (int l = 0; l < lanes; l++)
+        chip8_copy(&start[l], w->chip[l]);
+    wide_sync_in(w);
+
+    uint64_t t0 = now_ns();
+    uint64_t steps = wide_run(w, cycles);
+    double secs = (now_ns() - t0) / 1e9;
+    wide_sync_out(w);
+
+    printf("rom:        %s\n", path);
+    printf("lanes:      %d x %llu cycles\n", lanes, (unsigned long long)cycles);
+    printf("time:       %.3f s\n", secs);
+    printf("lane ips:   %.0f\n", secs > 0 ? cycles * lanes / secs : 0.0);
+    printf("lockstep:   %.2f lanes per step\n", steps ? (double)cycles * lanes / steps : 0.0);
+
+    int ok = 1;
+    for (int l = 0; l < lanes; l++){
+        Chip8 *ref = &start[l];
+        chip8_run(ref, cycles);
+        if (!same_state(ref, w->chip[l])){
+            printf("lane %d diverged from the scalar core\n", l);
+            ok = 0;
+        }
+        mem_release(ref);
+    }
+    if (ok)
+        printf("all lanes match the scalar core\n");
+    free(start);
+    wide_destroy(w);
+    return ok;
+}
@@ -0,0 +1,144 @@
+/*
+    libchip8, the emulator as a library. this is all of its api; the tools the chip8 command
+    is made of (batch runs, the fuzzer, the engine checkers, ...) are in tools.h, not here:
+
+        Chip8 *chip = chip8_create(seed);
+        chip8_load_rom(chip, rom, rom_size);
+        for (;;){
+            chip8_run_until_frame(chip);        // 1/60 s of emulated time
+            if (chip8_screen_dirty(chip)){
+                draw(chip8_screen(chip));       // see chip8_screen_size(), x = 0 is the top bit
+                chip8_screen_seen(chip);
+            }
+        }
+        chip8_destroy(chip);
+
+    three machines are built in: plain CHIP-8, SUPER-CHIP (128x64 hires, scrolling, 16x16
+    sprites) and XO-CHIP (on top of that 64 KB of memory and a second bit plane). each has its
+    own interpreter, specialized for its quirks at compile time. chip8_load_file() picks one from
+    the file's extension (.sc8, .xo8, anything else is CHIP-8) unless chip8_set_variant() chose.
+
+    a Chip8 is opaque. chip8_create() allocates one; chip8_create_in() lays it out in memory
+    the caller owns (an arena, shared memory, a static buffer) of at least chip8_size() bytes.
+    guest memory isn't part of that: every instance of a rom shares its pages read-only and
+    gets a private copy of a 256 byte page the first time it writes to it. neither are the
+    hires screens and XO-CHIP's page tables, a chip allocates those when it becomes one of
+    those machines. instances share nothing mutable, any number of them can run on
+    different threads at once.
+*/
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define CHIP8_WIDTH         64
+#define CHIP8_HEIGHT        32
+#define CHIP8_MEMORY_SIZE   4096
+#define CHIP8_TIMER_HZ      60      // delay and sound timers count down this many times per second
+#define CHIP8_DEFAULT_IPS   720     // instructions per emulated second, 12 per timer tick
+#define CHIP8_SNAP_SIZE     4448    // bytes chip8_save() writes
+#define CHIP8_HIRES_WIDTH   128     // SUPER-CHIP and XO-CHIP after 00FF
+#define CHIP8_HIRES_HEIGHT  64
+
+enum {
+    CHIP8_VARIANT_CHIP8,            // the original instruction set, what everything defaults to
+    CHIP8_VARIANT_SCHIP,            // SUPER-CHIP 1.1: Bxnn jumps to xnn + Vx
+    CHIP8_VARIANT_XOCHIP,           // XO-CHIP: shifts read Vy, Fx55/Fx65 move I, sprites wrap
+    CHIP8_VARIANTS
+};
+
+typedef struct Chip8 Chip8;
+typedef struct Chip8Input Chip8Input;
+typedef struct Chip8Rewind Chip8Rewind;
+
+// everything the program can see, copied out by chip8_regs()
+typedef struct Chip8Regs {
+    uint16_t        pc, I, sp;
+    uint16_t        opcode;         // the instruction at pc, about to run
+    uint16_t        stack[16];
+    uint8_t         v[16];
+    uint8_t         delay, sound;   // timers
+    uint16_t        keys;           // bit k is set while key k is down
+    uint64_t        cycles;         // instructions run so far
+} Chip8Regs;
+
+/* instances */
+size_t      chip8_size(void);
+Chip8       *chip8_create(uint64_t seed);                           // NULL if out of memory
+Chip8       *chip8_create_in(void *mem, size_t size, uint64_t seed);   // NULL if mem won't do
+void        chip8_destroy(Chip8 *chip);
+void        chip8_seed(Chip8 *chip, uint64_t seed);                 // Cxkk stream
+void        chip8_set_ips(Chip8 *chip, uint32_t ips);               // a multiple of CHIP8_TIMER_HZ
+int         chip8_set_variant(Chip8 *chip, int variant);            // before a rom goes in, 0 if unknown
+int         chip8_variant(const Chip8 *chip);
+int         chip8_variant_named(const char *name);                  // "chip8", "schip", "xochip" or -1
+
+/* roms, 0 on failure. either one starts a fresh run: cpu, timers, screen and memory as at
+   power on, only the seed's rng stream, the speed and what's attached carry over */
+int         chip8_load_rom(Chip8 *chip, const uint8_t *rom, size_t rom_size);
+int         chip8_load_file(Chip8 *chip, char *path);               // a .ch8 or a snapshot
+
+/* running. each returns how many instructions ran */
+uint64_t    chip8_run(Chip8 *chip, uint64_t cycles);
+uint64_t    chip8_run_until_frame(Chip8 *chip);                     // up to the next timer tick
+void        chip8_key(Chip8 *chip, int key, int down);
+
+/* looking at it. a screen row is width / 64 uint64_t, the left-most pixel in the top bit */
+const uint64_t *chip8_screen(const Chip8 *chip);
+const uint64_t *chip8_screen_plane(const Chip8 *chip, int plane);     // XO-CHIP has planes 0 and 1
+void        chip8_screen_size(const Chip8 *chip, int *width, int *height);
+int         chip8_screen_dirty(const Chip8 *chip);                  // changed since chip8_screen_seen()
+void        chip8_screen_seen(Chip8 *chip);
+uint64_t    chip8_screen_hash(Chip8 *chip);
+void        chip8_regs(const Chip8 *chip, Chip8Regs *regs);
+uint8_t     chip8_peek(const Chip8 *chip, uint16_t addr);
+char        *chip8_disasm(uint16_t opcode, int variant, char *buf, size_t size); // as that machine runs it
+
+/* snapshots and rewind, CHIP-8 only */
+size_t      chip8_save(const Chip8 *chip, uint8_t *buf);            // buf holds CHIP8_SNAP_SIZE, 0 if not CHIP-8
+int         chip8_load(Chip8 *chip, const uint8_t *buf, size_t size);
+int         chip8_save_file(const Chip8 *chip, const char *path);   // chip8_load_file() takes it back
+Chip8Rewind *chip8_rewind_create(double seconds);
+void        chip8_rewind_destroy(Chip8Rewind *r);
+void        chip8_rewind_push(Chip8Rewind *r, const Chip8 *chip);
+int         chip8_rewind_restore(Chip8Rewind *r, Chip8 *chip, size_t back);
+
+/* key replays: play one back, or record a session into one */
+Chip8Input  *chip8_input_open(const char *path, uint64_t *seed, uint32_t *ips);
+Chip8Input  *chip8_input_record(const char *path, uint64_t seed, const Chip8 *chip);
+void        chip8_input_attach(Chip8 *chip, Chip8Input *in);
+void        chip8_input_close(Chip8Input *in);
+
+/* the x86-64 recompiler */
+int         chip8_jit_attach(Chip8 *chip);                          // 0 if there's none for this host
+void        chip8_jit_detach(Chip8 *chip);
+uint64_t    chip8_run_jit(Chip8 *chip, uint64_t cycles);
+
+/* superinstructions: the interpreter runs hot idioms (set up and draw a sprite, count a loop,
+   wait on the delay timer) in one dispatch each, picked by how often their ops ran */
+int         chip8_fuse(Chip8 *chip, uint64_t warmup);               // count that many instructions first, 0: fuse all now
+int         chip8_fuse_save(const Chip8 *chip, const char *path);   // the op pair/triple counts it picked from
+int         chip8_fuse_load(Chip8 *chip, const char *path);         // pick from saved counts instead, fuse now
+
+/* debugger: breakpoints, and watchpoints on memory and registers, each with an optional
+   condition such as "v3 == 0x10 && [i + 1] > 2" (v0-vf, i, pc, sp, dt, st, keys, [addr]).
+   points mark the instructions they could stop at, everything else runs at full speed.
+   chip8_run() returns early on a stop, before the instruction, and runs it next time */
+#define CHIP8_DEBUG_READ    1
+#define CHIP8_DEBUG_WRITE   2
+int         chip8_debug_attach(Chip8 *chip);
+void        chip8_debug_detach(Chip8 *chip);
+int         chip8_debug_break(Chip8 *chip, uint16_t pc, const char *cond);    // the point's id, 0 if it can't
+int         chip8_debug_watch(Chip8 *chip, const char *what, int rw, const char *cond); // what: v0-vf, i, addr, addr-addr
+int         chip8_debug_delete(Chip8 *chip, int id);
+int         chip8_debug_stopped(Chip8 *chip);                       // the point the last run stopped at, 0 if none
+int         chip8_debug_eval(const Chip8 *chip, const char *expr, long *value);
+
+/* execution trace */
+int         chip8_trace_attach(Chip8 *chip);
+void        chip8_trace_detach(Chip8 *chip);
+void        chip8_trace_dump(FILE *out, Chip8 *chip, uint64_t n);
+
+#endif
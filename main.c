@@ -0,0 +1,689 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <termios.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+
+#include "tools.h"
+
+/*
+    the chip8 command: an interactive terminal front end plus the headless, batch, lockstep,
+    recompiler and replay tools, all driven through libchip8 (chip8.h).
+*/
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+    the interactive loop runs on two threads. the emulation thread owns the chip: it paces
+    frames, feeds keys in and, whenever the screen, the buzzer or pc moved, publishes a Frame.
+    the presenter (the main thread) puts the newest one it can get on the terminal. they meet
+    in a triple buffer: the producer always has a slot of its own to fill and swaps it for the
+    shared middle one, the presenter swaps its own for the middle one when that holds a frame
+    it hasn't seen. neither ever waits for the other. a frame the presenter was too slow for
+    is overwritten in the middle slot and never shown, so a slow terminal costs frames on
+    screen, never emulated time.
+*/
+#define FRAME_NS (1000000000ULL / CHIP8_TIMER_HZ)
+#define SCREEN_WORDS (CHIP8_HIRES_WIDTH / 64 * CHIP8_HIRES_HEIGHT)  // a plane at its biggest
+
+typedef struct Frame {
+    uint64_t        screen[2][SCREEN_WORDS];  // bit planes, the second only ever set by XO-CHIP
+    int             width, height;  // 64x32, or 128x64 in hires
+    uint64_t        number;         // pacer frame it was taken after
+    uint16_t        pc, opcode;     // for the status line
+    int             variant;        // CHIP8_VARIANT_*, to disassemble opcode as
+    uint8_t         sound;          // sound timer, the buzzer is on while it's nonzero
+} Frame;
+
+#define TB_FRESH    4               // in TripleBuffer.middle: the frame there hasn't been taken
+
+typedef struct TripleBuffer {
+    Frame           slot[3];
+    int             back;           // slot the producer fills, only it touches this
+    int             front;          // slot the presenter shows, only it touches this
+    int             middle;         // the one in between, | TB_FRESH while it's new
+    sem_t           ready;          // posted on every publish, the presenter sleeps on it
+} TripleBuffer;
+
+static int tb_init(TripleBuffer *tb){
+    memset(tb, 0, sizeof(*tb));
+    tb->back = 0;
+    tb->middle = 1;
+    tb->front = 2;
+    return sem_init(&tb->ready, 0, 0) == 0;
+}
+
+static void tb_destroy(TripleBuffer *tb){
+    sem_destroy(&tb->ready);
+}
+
+/* producer: the frame to fill in before tb_publish() */
+static Frame *tb_back(TripleBuffer *tb){
+    return &tb->slot[tb->back];
+}
+
+static void tb_publish(TripleBuffer *tb){
+    // if the old middle frame was still fresh the presenter never sees it, it's dropped
+    tb->back = __atomic_exchange_n(&tb->middle, tb->back | TB_FRESH, __ATOMIC_ACQ_REL) & 3;
+    sem_post(&tb->ready);
+}
+
+/* presenter: the newest frame if there's one it hasn't had yet, else NULL */
+static const Frame *tb_take(TripleBuffer *tb){
+    // only the producer sets TB_FRESH, so once seen it stays until the exchange below
+    if (!(__atomic_load_n(&tb->middle, __ATOMIC_ACQUIRE) & TB_FRESH))
+        return NULL;
+    tb->front = __atomic_exchange_n(&tb->middle, tb->front, __ATOMIC_ACQ_REL) & 3;
+    return &tb->slot[tb->front];
+}
+
+/* presenter: sleep until something was published, or `ns` went by. 1 if something was */
+static int tb_wait(TripleBuffer *tb, uint64_t ns){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ns += ts.tv_nsec;
+    ts.tv_sec += ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    if (sem_timedwait(&tb->ready, &ts) != 0)
+        return 0;
+    while (sem_trywait(&tb->ready) == 0)
+        ;                           // one frame to show however many came in
+    return 1;
+}
+
+/*
+    terminal renderer, the presenter's half. it compares a frame with what it last put on the
+    terminal and sends only the cells that changed, as runs of ANSI cursor moves plus
+    characters, built up in one buffer and handed to a single write().
+*/
+
+typedef struct Render {
+    uint64_t        shown[2][SCREEN_WORDS]; // screen as it is on the terminal
+    int             width, height;  // of what's shown
+    int             valid;          // shown[] is meaningful (something was drawn already)
+    char            *buf;
+    size_t          len, cap;
+    uint64_t        last_frame;     // when the last frame was presented
+    uint16_t        status_pc;      // what the status line below the screen shows
+    uint8_t         beeping;        // sound timer was running at the last frame
+} Render;
+
+static void render_put(Render *r, const char *s, size_t n){
+    if (r->len + n > r->cap){
+        size_t cap = r->cap ? r->cap * 2 : 4096;
+        while (cap < r->len + n) cap *= 2;
+        char *buf = (char*)realloc(r->buf, cap);
+        if (buf == NULL)
+            return;
+        r->buf = buf;
+        r->cap = cap;
+    }
+    memcpy(r->buf + r->len, s, n);
+    r->len += n;
+}
+
+static void render_str(Render *r, const char *s){
+    render_put(r, s, strlen(s));
+}
+
+static void render_flush(Render *r){
+    size_t off = 0;
+    while (off < r->len){
+        ssize_t n = write(STDOUT_FILENO, r->buf + off, r->len - off);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    r->len = 0;
+}
+
+// a cell by the planes its pixel is set in: none, 1, 2, both
+static const char pixel_chars[] = " *+#";
+
+void render_init(Render *r){
+    memset(r, 0, sizeof(*r));
+    r->width = CHIP8_WIDTH;
+    r->height = CHIP8_HEIGHT;
+    render_str(r, "\x1b[2J\x1b[?25l");     // clear, hide the cursor
+    render_flush(r);
+}
+
+void render_done(Render *r){
+    char move[32];
+    snprintf(move, sizeof(move), "\x1b[%d;1H\x1b[?25h\n", r->height + 3);
+    render_str(r, move);
+    render_flush(r);
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/* send whatever changed since the last frame. returns 1 if anything was written */
+int render_frame(Render *r, const Frame *f){
+    char cell[32];
+    int wrote = 0;
+    if (f->width != r->width || f->height != r->height){
+        // the mode changed, start over on a clear terminal
+        render_str(r, "\x1b[2J");
+        r->width = f->width;
+        r->height = f->height;
+        r->valid = 0;
+    }
+    int words = f->width / 64;
+    for (int y = 0; y < f->height; y++){
+        for (int k = 0; k < words; k++){
+            int i = y * words + k;
+            uint64_t p0 = f->screen[0][i], p1 = f->screen[1][i];
+            uint64_t diff = r->valid ? (p0 ^ r->shown[0][i]) | (p1 ^ r->shown[1][i]) : ~0ULL;
+            int x = 0;
+            while (diff != 0 && x < 64){
+                // skip to the next changed cell, then emit the whole run of changed cells
+                int skip = __builtin_clzll(diff);
+                x += skip;
+                diff <<= skip;
+                snprintf(cell, sizeof(cell), "\x1b[%d;%dH", y + 1, k * 64 + x + 1);
+                render_str(r, cell);
+                while (x < 64 && (diff & (1ULL << 63))){
+                    render_put(r, &pixel_chars[(p0 >> (63 - x) & 1) | (p1 >> (63 - x) & 1) << 1], 1);
+                    diff <<= 1;
+                    x++;
+                }
+            }
+            r->shown[0][i] = p0;
+            r->shown[1][i] = p1;
+        }
+    }
+    if (f->pc != r->status_pc || !r->valid){
+        char text[32];
+        snprintf(cell, sizeof(cell), "\x1b[%d;1H\x1b[K", f->height + 2);
+        render_str(r, cell);
+        snprintf(cell, sizeof(cell), "pc %03x  ", f->pc);
+        render_str(r, cell);
+        render_str(r, chip8_disasm(f->opcode, f->variant, text, sizeof(text)));
+        r->status_pc = f->pc;
+    }
+    r->valid = 1;
+    if ((f->sound != 0) != r->beeping){
+        // the terminal bell is the only buzzer we have, ring it when the sound starts
+        if (f->sound != 0)
+            render_put(r, "\a", 1);
+        r->beeping = f->sound != 0;
+    }
+    wrote = r->len != 0;
+    render_flush(r);
+    r->last_frame = now_ns();
+    return wrote;
+}
+
+/*
+    interactive pacing. the cpu runs a frame at a time, a frame being the instructions up
+    to the next timer tick (chip8_run_until_frame()), and frame k is due k/60 s after the start on the
+    monotonic clock. when the host falls behind (stopped, swapping) the
+    missed frames run back to back, but at most MAX_CATCHUP of them; anything older is written
+    off rather than fast-forwarding the game. turbo runs frames without ever sleeping, the
+    timers still tick once per frame of emulated time so games simply run faster.
+*/
+#define MAX_CATCHUP 6
+
+typedef struct Pacer {
+    uint64_t        start;          // when frame 0 was due
+    uint64_t        frames;         // frames run so far
+    int             turbo;
+} Pacer;
+
+void pacer_init(Pacer *p, int turbo){
+    p->start = now_ns();
+    p->frames = 0;
+    p->turbo = turbo;
+}
+
+/* run every frame that is due by now (turbo: as many as fit in one frame of wall time) */
+uint64_t pacer_run(Pacer *p, Chip8 *chip){
+    uint64_t now = now_ns(), ran = 0;
+    if (p->turbo){
+        uint64_t until = now + FRAME_NS;
+        do {
+            ran += chip8_run_until_frame(chip);
+            p->frames++;
+        } while (now_ns() < until);
+        return ran;
+    }
+    uint64_t due = (now - p->start) / FRAME_NS + 1;
+    if (due > p->frames + MAX_CATCHUP)
+        p->frames = due - MAX_CATCHUP;
+    for (; p->frames < due; p->frames++)
+        ran += chip8_run_until_frame(chip);
+    return ran;
+}
+
+/* sleep until the next frame is due */
+void pacer_wait(Pacer *p){
+    if (p->turbo)
+        return;
+    uint64_t at = p->start + p->frames * FRAME_NS;
+    struct timespec ts = { (time_t)(at / 1000000000ULL), (long)(at % 1000000000ULL) };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL); // a signal just ends it early
+}
+
+/*
+    live keyboard for the interactive loop. a thread reads the terminal (raw, no echo) and
+    pushes key presses into a single producer, single consumer ring; the emulation thread
+    drains it between frames, never waiting on it. terminals only report presses (and
+    auto-repeat them while a key is held), so a key is let go KEY_HOLD frames after the last
+    press seen for it. the layout is the usual one:
+
+        1 2 3 4        1 2 3 C
+        q w e r   ->   4 5 6 D
+        a s d f        7 8 9 E
+        z x c v        A 0 B F
+*/
+#define KEYQ_SIZE   256             // power of two
+#define KEY_HOLD    12
+
+static const char key_map[] = "x123qweasdzc4rfv";  // host key for chip8 key 0-F
+
+typedef struct KeyQueue {
+    uint8_t         ev[KEYQ_SIZE];  // chip8 key pressed
+    size_t          head;           // written by the input thread only
+    size_t          tail;           // written by the emulation thread only
+} KeyQueue;
+
+static int keyq_push(KeyQueue *q, uint8_t key){
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == KEYQ_SIZE)
+        return 0;                   // full, drop it rather than wait
+    q->ev[head & (KEYQ_SIZE - 1)] = key;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int keyq_pop(KeyQueue *q, uint8_t *key){
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    if (tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+        return 0;
+    *key = q->ev[tail & (KEYQ_SIZE - 1)];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+typedef struct Keyboard {
+    KeyQueue        queue;
+    pthread_t       thread;
+    int             running, stop;
+    int             raw;            // terminal settings below have to be put back
+    struct termios  saved;
+    uint64_t        held[16];       // frame until which each key stays down
+} Keyboard;
+
+static void *keyboard_thread(void *arg){
+    Keyboard *kb = (Keyboard*)arg;
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    while (!__atomic_load_n(&kb->stop, __ATOMIC_RELAXED)){
+        char buf[64];
+        if (poll(&pfd, 1, 50) <= 0)
+            continue;
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        for (ssize_t i = 0; i < n; i++){
+            char c = buf[i] >= 'A' && buf[i] <= 'Z' ? buf[i] - 'A' + 'a' : buf[i];
+            const char *k = c > ' ' ? strchr(key_map, c) : NULL;
+            if (k != NULL)
+                keyq_push(&kb->queue, k - key_map);
+        }
+    }
+    return NULL;
+}
+
+int keyboard_start(Keyboard *kb){
+    memset(kb, 0, sizeof(*kb));
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &kb->saved) == 0){
+        struct termios raw = kb->saved;
+        raw.c_lflag &= ~(ICANON | ECHO);    // keys as they come, ctrl-c still works
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        kb->raw = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+    }
+    kb->running = pthread_create(&kb->thread, NULL, keyboard_thread, kb) == 0;
+    return kb->running;
+}
+
+void keyboard_stop(Keyboard *kb){
+    __atomic_store_n(&kb->stop, 1, __ATOMIC_RELAXED);
+    if (kb->running)
+        pthread_join(kb->thread, NULL);
+    if (kb->raw)
+        tcsetattr(STDIN_FILENO, TCSANOW, &kb->saved);
+}
+
+/* between frames: press what was typed since the last call, let go of keys not seen lately */
+void keyboard_poll(Keyboard *kb, Chip8 *chip, uint64_t frame){
+    uint8_t key;
+    while (keyq_pop(&kb->queue, &key)){
+        chip8_key(chip, key, 1);
+        kb->held[key] = frame + KEY_HOLD;
+    }
+    for (int k = 0; k < 16; k++)
+        if (kb->held[k] != 0 && kb->held[k] <= frame){
+            chip8_key(chip, k, 0);
+            kb->held[k] = 0;
+        }
+}
+
+/*
+    the emulation thread: pacing, keys and publishing frames. the chip is its alone until
+    emulator_stop() has joined it.
+*/
+typedef struct Emulator {
+    Chip8           *chip;
+    Pacer           pacer;
+    Keyboard        *kb;            // NULL while watching a replay
+    TripleBuffer    *tb;
+    pthread_t       thread;
+    int             running, stop;
+    uint16_t        pc;             // in the last frame published
+    uint8_t         sound;
+} Emulator;
+
+/* hand the presenter a frame if anything it shows moved, or regardless with force */
+static void emulator_publish(Emulator *e, int force){
+    Chip8Regs regs;
+    chip8_regs(e->chip, &regs);
+    if (!force && !chip8_screen_dirty(e->chip) && regs.pc == e->pc && (regs.sound != 0) == e->sound)
+        return;
+    Frame *f = tb_back(e->tb);
+    chip8_screen_size(e->chip, &f->width, &f->height);
+    size_t bytes = f->width / 64 * f->height * sizeof(uint64_t);
+    memcpy(f->screen[0], chip8_screen_plane(e->chip, 0), bytes);
+    memcpy(f->screen[1], chip8_screen_plane(e->chip, 1), bytes);
+    f->number = e->pacer.frames;
+    f->pc = regs.pc;
+    f->opcode = regs.opcode;
+    f->variant = chip8_variant(e->chip);
+    f->sound = regs.sound;
+    tb_publish(e->tb);
+    chip8_screen_seen(e->chip);
+    e->pc = regs.pc;
+    e->sound = regs.sound != 0;
+}
+
+static void *emulator_thread(void *arg){
+    Emulator *e = (Emulator*)arg;
+    emulator_publish(e, 1);
+    while (!__atomic_load_n(&e->stop, __ATOMIC_RELAXED)){
+        if (e->kb != NULL)
+            keyboard_poll(e->kb, e->chip, e->pacer.frames);
+        pacer_run(&e->pacer, e->chip);
+        emulator_publish(e, 0);
+        pacer_wait(&e->pacer);
+    }
+    emulator_publish(e, 1);        // how it ended, for the presenter's last frame
+    return NULL;
+}
+
+int emulator_start(Emulator *e, Chip8 *chip, Keyboard *kb, TripleBuffer *tb, int turbo){
+    memset(e, 0, sizeof(*e));
+    e->chip = chip;
+    e->kb = kb;
+    e->tb = tb;
+    pacer_init(&e->pacer, turbo);
+    e->running = pthread_create(&e->thread, NULL, emulator_thread, e) == 0;
+    return e->running;
+}
+
+void emulator_stop(Emulator *e){
+    __atomic_store_n(&e->stop, 1, __ATOMIC_RELAXED);
+    if (e->running)
+        pthread_join(e->thread, NULL);
+    e->running = 0;
+}
+
+void usage(const char *prog){
+    fprintf(stderr, "usage: %s [-f] [-V machine] [-i ips] [-s seed] [-k replay] [-p replay] [-b] [-j] [-J] [-g warmup] [-G counts] [-u] [-d script] [-S] [-w file] [-R frames] [-T records] [-c cycles] [-t seconds] [rom]\n", prog);
+    fprintf(stderr, "       %s -B manifest [-o results] [-n threads]\n", prog);
+    fprintf(stderr, "       %s -W lanes [-c cycles] [-s seed] rom\n", prog);
+    fprintf(stderr, "       %s -F corpus [-c cycles] [-t seconds] [-s seed] [rom]\n", prog);
+    fprintf(stderr, "\t-V machine  chip8, schip or xochip (default: by the rom's extension, .sc8 and .xo8)\n");
+    fprintf(stderr, "\t-i ips      instructions per emulated second, a multiple of 60 (default %d)\n", CHIP8_DEFAULT_IPS);
+    fprintf(stderr, "\t-s seed     seed for Cxkk (default: 0 headless, the clock interactive)\n");
+    fprintf(stderr, "\t-f          turbo: run as fast as the host can, timers still follow emulated time\n");
+    fprintf(stderr, "\t-b          headless: run flat out with no output, then report speed\n");
+    fprintf(stderr, "\t-c cycles   headless: stop after this many instructions\n");
+    fprintf(stderr, "\t-t seconds  headless: stop after this much wall-clock time\n");
+    fprintf(stderr, "\t-j          headless: run through the x86-64 recompiler\n");
+    fprintf(stderr, "\t-k file     record every key event (with its cycle) to a replay file\n");
+    fprintf(stderr, "\t-p file     feed a recorded replay back in, with the seed and speed it was made with\n");
+    fprintf(stderr, "\t-w file     headless: save the final state to file, give it back in place of a rom\n");
+    fprintf(stderr, "\t-R frames   run -c cycles keeping history, rewind that many frames and check the replay\n");
+    fprintf(stderr, "\t-T records  headless: trace execution and dump the last records at the end\n");
+    fprintf(stderr, "\t-J          check the recompiler against the interpreter for -c cycles\n");
+    fprintf(stderr, "\t-g warmup   fuse the idioms that were hot over the first warmup instructions (0: all of them)\n");
+    fprintf(stderr, "\t-G counts   with -g, save the op counts it fused from to a file, alone fuse from saved ones\n");
+    fprintf(stderr, "\t-u          check the fused interpreter (-g, default 0) against the plain one for -c cycles\n");
+    fprintf(stderr, "\t-d script   debugger: run the commands in script ('-' for the terminal), -c caps each continue\n");
+    fprintf(stderr, "\t-S          write the rom out as a C file (ahead-of-time recompile) on stdout\n");
+    fprintf(stderr, "\t-B manifest run every job in the manifest on all cores\n");
+    fprintf(stderr, "\t-o results  where -B writes one line per job (default: stdout)\n");
+    fprintf(stderr, "\t-n threads  how many threads -B uses (default: one per core)\n");
+    fprintf(stderr, "\t-W lanes    run up to 32 copies of the rom in simd lockstep, then check each lane\n");
+    fprintf(stderr, "\t-F corpus   fuzz roms and keys (from rom, or the corpus), -c cycles a run (default 1000)\n");
+}
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_sigint(int sig){
+    (void)sig;
+    interrupted = 1;
+}
+
+int main(int argc, char **argv){
+    int headless = 0;
+    int use_jit = 0;
+    int fusing = 0, fuse_test = 0;
+    uint64_t fuse_warmup = 0;
+    char *fuse_counts = NULL;
+    char *debug_script = NULL;
+    int aot = 0;
+    char *manifest = NULL;
+    char *corpus = NULL;
+    char *results = "-";
+    int nthreads = 0;
+    int lanes = 0;
+    int turbo = 0;
+    uint32_t ips = CHIP8_DEFAULT_IPS;
+    int variant = -1;
+    uint64_t seed = 0;
+    int seeded = 0;
+    char *save = NULL;
+    char *record = NULL, *replay = NULL;
+    Chip8Input *input = NULL;
+    long rewind_back = -1;
+    uint64_t trace_records = 0;
+    uint64_t max_cycles = 0;
+    double max_seconds = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "fV:i:s:k:p:w:R:bjJg:G:ud:SB:o:n:W:F:T:c:t:h")) != -1){
+        switch(opt){
+            case 'f': turbo = 1; break;
+            case 'V':
+                if ((variant = chip8_variant_named(optarg)) < 0){
+                    fprintf(stderr, "Error: no machine called %s, there's chip8, schip and xochip\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'i': ips = strtoul(optarg, NULL, 0); break;
+            case 's': seed = strtoull(optarg, NULL, 0); seeded = 1; break;
+            case 'k': record = optarg; break;
+            case 'p': replay = optarg; break;
+            case 'w': headless = 1; save = optarg; break;
+            case 'R': headless = 1; rewind_back = atol(optarg); break;
+            case 'b': headless = 1; break;
+            case 'j': headless = 1; use_jit = 1; break;
+            case 'J': headless = 1; use_jit = 2; break;
+            case 'g': fusing = 1; fuse_warmup = strtoull(optarg, NULL, 0); break;
+            case 'G': fuse_counts = optarg; break;
+            case 'u': headless = 1; fuse_test = 1; break;
+            case 'd': debug_script = optarg; break;
+            case 'S': aot = 1; break;
+            case 'B': manifest = optarg; break;
+            case 'o': results = optarg; break;
+            case 'n': nthreads = atoi(optarg); break;
+            case 'W': lanes = atoi(optarg); break;
+            case 'F': corpus = optarg; break;
+            case 'T': headless = 1; trace_records = strtoull(optarg, NULL, 0); break;
+            case 'c': headless = 1; max_cycles = strtoull(optarg, NULL, 0); break;
+            case 't': headless = 1; max_seconds = atof(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (manifest != NULL)
+        return run_batch(manifest, results, nthreads) ? 0 : 1;
+    if (corpus != NULL)
+        return run_fuzz(optind < argc ? argv[optind] : NULL, corpus, max_cycles ? max_cycles : 1000,
+                        max_seconds > 0 ? max_seconds : 10, seed) ? 0 : 1;
+    if (lanes > 0 && optind < argc)
+        return run_wide(argv[optind], lanes, max_cycles ? max_cycles : 1000000, seed) ? 0 : 1;
+    if (headless && max_cycles == 0 && max_seconds <= 0)
+        max_seconds = 1.0;
+    // headless and debugger runs are repeatable unless asked otherwise, a game gets a new stream each time
+    if (!headless && !aot && !seeded && debug_script == NULL)
+        seed = (uint64_t)time(NULL);
+    // a replay only reproduces the session with the seed and speed it was recorded with
+    if (replay != NULL && (input = chip8_input_open(replay, &seed, &ips)) == NULL)
+        return 1;
+
+    Chip8 *chip = chip8_create(seed);
+    if (chip == NULL)
+        return 1;
+    // char *p = "IBM.ch8";
+    char *p = optind < argc ? argv[optind] : "Clock.ch8";
+    if ((variant >= 0 && !chip8_set_variant(chip, variant)) || !chip8_load_file(chip, p))
+        return 1;
+    chip8_set_ips(chip, ips);
+    if (record != NULL && (input = chip8_input_record(record, seed, chip)) == NULL)
+        return 1;
+    chip8_input_attach(chip, input);
+    if ((aot || use_jit) && chip8_variant(chip) != CHIP8_VARIANT_CHIP8){
+        fprintf(stderr, "%s", "Error: the recompilers are CHIP-8 only\n");
+        return 1;
+    }
+    if (aot){
+        aot_emit(stdout, chip, p);
+        chip8_destroy(chip);
+        return 0;
+    }
+    if (use_jit){
+        if (!chip8_jit_attach(chip)){
+            fprintf(stderr, "%s", "Error: no recompiler for this platform\n");
+            return 1;
+        }
+    }
+    // -G alone fuses from counts saved earlier, with -g it's where this run's go
+    if (fuse_counts != NULL && !fusing){
+        if (!chip8_fuse_load(chip, fuse_counts))
+            return 1;
+    } else if ((fusing || fuse_test) && !chip8_fuse(chip, fuse_warmup)){
+        fprintf(stderr, "%s", "Error: can't count ops for fusion\n");
+        return 1;
+    }
+    if (debug_script != NULL){
+        FILE *f = strcmp(debug_script, "-") == 0 ? stdin : fopen(debug_script, "r");
+        if (f == NULL){
+            fprintf(stderr, "Error: could not open %s\n", debug_script);
+            return 1;
+        }
+        int ok = run_debug(chip, f, max_cycles);
+        if (f != stdin)
+            fclose(f);
+        chip8_input_close(input);
+        chip8_destroy(chip);
+        return ok ? 0 : 1;
+    }
+    if (rewind_back >= 0){
+        int ok = rewind_check(chip, p, max_cycles ? max_cycles : 1000000, rewind_back);
+        chip8_destroy(chip);
+        return ok ? 0 : 1;
+    }
+    if (use_jit == 2 || fuse_test){
+        Chip8 *ref = chip8_create(seed);
+        if (ref == NULL || (variant >= 0 && !chip8_set_variant(ref, variant)) || !chip8_load_file(ref, p))
+            return 1;
+        chip8_set_ips(ref, ips);
+        Chip8Input *ref_input = replay != NULL ? chip8_input_open(replay, &seed, &ips) : NULL;
+        chip8_input_attach(ref, ref_input);
+        uint64_t cycles = max_cycles ? max_cycles : 1000000;
+        int ok = use_jit == 2 ? jit_check(chip, ref, p, cycles) : fuse_check(chip, ref, p, cycles);
+        chip8_input_close(ref_input);
+        chip8_input_close(input);
+        chip8_destroy(ref);
+        chip8_destroy(chip);
+        return ok ? 0 : 1;
+    }
+    if (headless){
+        if (trace_records && !chip8_trace_attach(chip)){
+            fprintf(stderr, "%s", "Error: can't trace while -g is counting ops\n");
+            return 1;
+        }
+        run_headless(chip, p, max_cycles, max_seconds, use_jit ? chip8_run_jit : chip8_run);
+        chip8_trace_dump(stdout, chip, trace_records);
+        int ok = save == NULL || chip8_save_file(chip, save);
+        if (fusing && fuse_counts != NULL)
+            ok = chip8_fuse_save(chip, fuse_counts) && ok;
+        chip8_input_close(input);
+        chip8_destroy(chip);
+        return ok ? 0 : 1;
+    }
+    Render render;
+    Keyboard kb;
+    TripleBuffer tb;
+    Emulator emu;
+    if (!tb_init(&tb)){
+        fprintf(stderr, "%s", "Error: creating the frame buffer\n");
+        return 1;
+    }
+    render_init(&render);
+    signal(SIGINT, on_sigint);
+    // watching a replay: the keys come from it, not from the terminal
+    if (replay == NULL && !keyboard_start(&kb))
+        fprintf(stderr, "%s", "warning: no keyboard input\n");
+    if (!emulator_start(&emu, chip, replay == NULL ? &kb : NULL, &tb, turbo)){
+        fprintf(stderr, "%s", "Error: starting the emulation thread\n");
+        interrupted = 1;
+    }
+    // the presenter: the newest frame, at most one per 1/60 s however fast they come in
+    while(!interrupted){
+        if (!tb_wait(&tb, FRAME_NS * 6))
+            continue;
+        const Frame *f = tb_take(&tb);
+        if (f != NULL)
+            render_frame(&render, f);
+        uint64_t next = render.last_frame + FRAME_NS;
+        struct timespec ts = { (time_t)(next / 1000000000ULL), (long)(next % 1000000000ULL) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    emulator_stop(&emu);
+    const Frame *last = tb_take(&tb);
+    if (last != NULL)
+        render_frame(&render, last);
+    render_done(&render);
+    tb_destroy(&tb);
+    if (replay == NULL)
+        keyboard_stop(&kb);
+    int ok = !fusing || fuse_counts == NULL || chip8_fuse_save(chip, fuse_counts);
+    chip8_input_close(input);
+    chip8_destroy(chip);
+    return ok ? 0 : 1;
+}
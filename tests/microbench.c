@@ -0,0 +1,214 @@
+/*
+    per opcode microbenchmarks for the interpreter core. each one is a tiny rom: a little
+    setup, then one opcode family unrolled OPS_PER_LOOP times and a jump back. it runs through
+    chip8_run() like any rom, so the timers and the memory write path are all in there.
+
+        microbench [-n instructions] [-t percent] baseline    compare, exit 1 on a regression
+        microbench [-n instructions] -w baseline              write a new baseline
+
+    a baseline is "name ns/op" per line. every bench runs REPEATS times, taking turns with the
+    others so a noisy stretch on the host hits them all alike, and keeps its best time: noise
+    can only make things look slower, never faster. one that comes out over the threshold gets
+    up to ATTEMPTS rounds in all before it counts as a regression.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chip8.h"
+
+#define OPS_PER_LOOP    32
+#define REPEATS         50
+#define ATTEMPTS        3
+#define MAX_BENCHES     16
+
+typedef struct Bench {
+    const char      *name;
+    uint16_t        setup[8];       // run once, 0 ends it
+    uint16_t        body[8];        // repeated to fill the loop, 0 ends it
+} Bench;
+
+static const Bench benches[] = {
+    { "7xkk",       { 0 },                              { 0x7001, 0x7102 } },           // dispatch alone
+    { "8xy4/8xy5",  { 0x6037, 0x61C9, 0 },              { 0x8014, 0x8015, 0x8214, 0x8125 } },
+    { "8xy6/8xye",  { 0x6037, 0x61C9, 0 },              { 0x8006, 0x811E } },
+    { "dxyn",       { 0xA000, 0x6005, 0x6107, 0 },      { 0xD018, 0xD01F } },
+    { "fx33",       { 0xA300, 0x60FE, 0 },              { 0xF033 } },
+    { "fx55/fx65",  { 0xA300, 0 },                      { 0xF755, 0xF765 } },
+    { "skips",      { 0x6001, 0x6101, 0 },              { 0x3001, 0x7000, 0x4002, 0x7100, 0x5010, 0x7000 } },
+};
+#define NBENCH (sizeof(benches) / sizeof(*benches))
+
+static uint64_t now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t build_rom(const Bench *b, uint8_t *rom){
+    size_t n = 0;
+    for (int i = 0; i < 8 && b->setup[i] != 0; i++){
+        rom[n++] = b->setup[i] >> 8;
+        rom[n++] = b->setup[i] & 0xFF;
+    }
+    uint16_t loop = 0x200 + n;
+    int len = 0;
+    while (len < 8 && b->body[len] != 0)
+        len++;
+    for (int i = 0; i < OPS_PER_LOOP; i++){
+        rom[n++] = b->body[i % len] >> 8;
+        rom[n++] = b->body[i % len] & 0xFF;
+    }
+    rom[n++] = 0x10 | loop >> 8;    // JP loop
+    rom[n++] = loop & 0xFF;
+    return n;
+}
+
+static Chip8 *open_bench(const Bench *b){
+    uint8_t rom[256];
+    size_t size = build_rom(b, rom);
+    Chip8 *chip = chip8_create(0);
+    if (chip == NULL || !chip8_load_rom(chip, rom, size)){
+        chip8_destroy(chip);
+        return NULL;
+    }
+    return chip;
+}
+
+// ns per instruction for one run of `cycles`
+static double time_run(Chip8 *chip, uint64_t cycles){
+    uint64_t start = now_ns();
+    uint64_t ran = chip8_run(chip, cycles);
+    return (double)(now_ns() - start) / (ran ? ran : 1);
+}
+
+// a round: REPEATS runs of the benches marked in `which`, ns keeps the best of each
+static void time_round(Chip8 **chips, const int *which, double *ns, uint64_t cycles){
+    for (int r = 0; r < REPEATS; r++){
+        for (size_t i = 0; i < NBENCH; i++){
+            if (!which[i])
+                continue;
+            double t = time_run(chips[i], cycles);
+            if (ns[i] < 0 || t < ns[i])
+                ns[i] = t;
+        }
+    }
+}
+
+static int baseline_of(const char *name, char names[][32], int nbase){
+    for (int k = 0; k < nbase; k++)
+        if (strcmp(names[k], name) == 0)
+            return k;
+    return -1;
+}
+
+static int read_baseline(const char *path, char names[][32], double *ns){
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    char line[128];
+    int n = 0;
+    while (n < MAX_BENCHES && fgets(line, sizeof(line), f) != NULL){
+        if (line[0] == '#' || sscanf(line, "%31s %lf", names[n], &ns[n]) != 2)
+            continue;
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static void usage(const char *prog){
+    fprintf(stderr, "usage: %s [-n instructions] [-t percent] baseline\n", prog);
+    fprintf(stderr, "       %s [-n instructions] -w baseline\n", prog);
+}
+
+int main(int argc, char **argv){
+    uint64_t cycles = 500000;
+    double threshold = 15;
+    int write = 0, opt;
+    while ((opt = getopt(argc, argv, "n:t:wh")) != -1){
+        switch (opt){
+            case 'n': cycles = strtoull(optarg, NULL, 10); break;
+            case 't': threshold = atof(optarg); break;
+            case 'w': write = 1; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc || cycles == 0){
+        usage(argv[0]);
+        return 1;
+    }
+    const char *path = argv[optind];
+
+    char names[MAX_BENCHES][32];
+    double base[MAX_BENCHES];
+    int nbase = 0;
+    if (!write && (nbase = read_baseline(path, names, base)) < 0){
+        fprintf(stderr, "Error: no baseline %s, make one with -w\n", path);
+        return 1;
+    }
+
+    Chip8 *chips[NBENCH];
+    double ns[NBENCH];
+    int slow[NBENCH];
+    for (size_t i = 0; i < NBENCH; i++){
+        if ((chips[i] = open_bench(&benches[i])) == NULL){
+            fprintf(stderr, "Error: %s didn't load\n", benches[i].name);
+            return 1;
+        }
+        time_run(chips[i], cycles);     // warm up: caches, branch predictors, own pages
+        ns[i] = -1;
+        slow[i] = 1;
+    }
+    for (int attempt = 0; attempt < ATTEMPTS; attempt++){
+        time_round(chips, slow, ns, cycles);
+        int any = 0;
+        for (size_t i = 0; i < NBENCH; i++){
+            int k = baseline_of(benches[i].name, names, nbase);
+            slow[i] = !write && k >= 0 && ns[i] > base[k] * (1 + threshold / 100);
+            any |= slow[i];
+        }
+        if (!any)
+            break;
+    }
+    for (size_t i = 0; i < NBENCH; i++)
+        chip8_destroy(chips[i]);
+
+    int regressed = 0;
+    printf("%-12s %10s %10s %8s\n", "bench", "ns/op", "baseline", "change");
+    for (size_t i = 0; i < NBENCH; i++){
+        int k = baseline_of(benches[i].name, names, nbase);
+        if (write || k < 0){
+            printf("%-12s %10.2f %10s\n", benches[i].name, ns[i], "-");
+            continue;
+        }
+        double change = (ns[i] / base[k] - 1) * 100;
+        int bad = change > threshold;
+        regressed |= bad;
+        printf("%-12s %10.2f %10.2f %+7.1f%%%s\n", benches[i].name, ns[i], base[k], change,
+               bad ? "  REGRESSION" : "");
+    }
+
+    if (write){
+        FILE *f = fopen(path, "w");
+        if (f == NULL){
+            fprintf(stderr, "Error: writing %s\n", path);
+            return 1;
+        }
+        fprintf(f, "# ns per instruction, best of %d runs of %llu (make microbench-baseline)\n",
+                REPEATS, (unsigned long long)cycles);
+        for (size_t i = 0; i < NBENCH; i++)
+            fprintf(f, "%s %.2f\n", benches[i].name, ns[i]);
+        fclose(f);
+        printf("baseline written to %s\n", path);
+        return 0;
+    }
+    if (regressed)
+        printf("slower than the baseline by more than %.0f%%\n", threshold);
+    return regressed;
+}
@@ -0,0 +1,25 @@
+/*
+    the tools the chip8 command is made of. they live in libchip8 next to the emulator they
+    poke at, but they aren't part of its api: only main.c and the tests include this.
+*/
+#ifndef CHIP8_TOOLS_H
+#define CHIP8_TOOLS_H
+
+#include "chip8.h"
+
+void        run_headless(Chip8 *chip, const char *path, uint64_t max_cycles, double max_seconds,
+                         uint64_t (*run)(Chip8 *chip, uint64_t cycles));
+int         run_batch(const char *manifest, const char *results, int nthreads);
+int         run_wide(char *path, int lanes, uint64_t cycles, uint64_t seed);
+int         run_fuzz(const char *rom, const char *dir, uint64_t cycles, double seconds, uint64_t seed);
+int         run_debug(Chip8 *chip, FILE *in, uint64_t max_cycles);
+
+/* run an engine next to the plain interpreter, 0 if they part ways */
+int         jit_check(Chip8 *jit, Chip8 *ref, const char *path, uint64_t max_cycles);
+int         fuse_check(Chip8 *fused, Chip8 *ref, const char *path, uint64_t max_cycles);
+int         rewind_check(Chip8 *chip, const char *path, uint64_t max_cycles, size_t back);
+
+/* write the rom loaded into chip out as C for the ahead-of-time build, see chip8.c */
+int         aot_emit(FILE *out, Chip8 *chip, const char *path);
+
+#endif